@@ -0,0 +1,121 @@
+#pragma once
+
+#include "sharded_cache.h"
+#include "thread_pool.h"
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace galib {
+
+/// @brief Thread-safe cache loading the missing values on a thread pool (see ShardedCache and ThreadPool).
+/// Concurrent misses on the same key share a single load (single flight): only the first one calls the loader.
+/// The loader runs without holding any lock of the cache, the loaded value is then inserted with Cache::put.
+/// @example AsyncCache<Cache<std::string, FileInfo, 2>> files([](const std::string &path) { return readInfo(path); });
+/// std::shared_future<FileInfo> info = files.getAsync("/etc/hosts");
+/// info.get();
+template <typename TCache, unsigned int TShardCount = 16> class AsyncCache {
+  public:
+    typedef typename TCache::key_type key_type;
+    typedef typename TCache::value_type value_type;
+    typedef std::function<value_type(const key_type &)> Loader;
+
+  public:
+    /// @param loader called on the threads of the pool. If it throws, the futures of the load get the exception and
+    /// nothing is inserted in the cache.
+    explicit AsyncCache(Loader loader, unsigned int threadCount = 4, size_t maxQueued = 1024)
+        : _loader(std::move(loader))
+        , _pool(threadCount, maxQueued) {}
+
+    virtual ~AsyncCache() {}
+
+    ShardedCache<TCache, TShardCount> &cache() { return _cache; }
+
+    /// @brief Returns a ready future if the key is in the cache. Otherwise joins the load of the key in progress, or
+    /// starts one.
+    /// @param ttl time to live in milliseconds of the loaded value (0: never expires).
+    std::shared_future<value_type> getAsync(const key_type &key, int levelIndex = -1, std::uint64_t ttl = 0) {
+        Flights &flights = _flights[ShardedCache<TCache, TShardCount>::shardIndex(key)];
+        std::unique_lock<std::mutex> lock(flights._mutex);
+
+        // The load stores the value in the cache before leaving the flights: holding the lock of the flights,
+        // the value is either in the cache or still in flight.
+        std::shared_future<value_type> result;
+        bool found = _cache.apply(key, [&](TCache &cache) {
+            KeyValue *kv = cache.touch(key, levelIndex);
+            if (kv != nullptr) {
+                std::promise<value_type> ready;
+                ready.set_value(kv->value());
+                result = ready.get_future().share();
+            }
+            return kv != nullptr;
+        });
+        if (found) {
+            return result;
+        }
+
+        auto flight = flights._pending.find(key);
+        if (flight != flights._pending.end()) {
+            return flight->second;
+        }
+
+        std::shared_ptr<std::promise<value_type>> promise = std::make_shared<std::promise<value_type>>();
+        result = promise->get_future().share();
+        flights._pending.emplace(key, result);
+        // Unlocked: submit blocks while the queue is full, and the queued loads need the lock to leave the flights.
+        // The misses on the key arriving meanwhile join the pending load.
+        lock.unlock();
+        _pool.submit([this, key, levelIndex, ttl, promise, &flights]() {
+            load(key, levelIndex, ttl, *promise, flights);
+        });
+        return result;
+    }
+
+    /// @brief Number of loads in progress or queued.
+    size_t getPendingCount() {
+        size_t count = 0;
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_flights[i]._mutex);
+            count += _flights[i]._pending.size();
+        }
+        return count;
+    }
+
+  private:
+    typedef typename TCache::KeyValue KeyValue;
+
+    // The loads in progress, split like the shards of the cache.
+    struct Flights {
+        std::mutex _mutex;
+        std::unordered_map<key_type, std::shared_future<value_type>> _pending;
+    };
+
+    void load(const key_type &key, int levelIndex, std::uint64_t ttl, std::promise<value_type> &promise,
+              Flights &flights) {
+        try {
+            value_type value = _loader(key);
+            _cache.apply(key, [&](TCache &cache) { cache.put(key, value, levelIndex, ttl); });
+            {
+                std::lock_guard<std::mutex> lock(flights._mutex);
+                flights._pending.erase(key);
+            }
+            promise.set_value(std::move(value));
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(flights._mutex);
+                flights._pending.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+        }
+    }
+
+    Loader _loader;
+    ShardedCache<TCache, TShardCount> _cache;
+    Flights _flights[TShardCount];
+    // Last: destroyed first, the loads in progress finish before the cache is destroyed.
+    ThreadPool _pool;
+};
+
+} // namespace galib
@@ -1,201 +1,1605 @@
 #pragma once
 
+#include "cache_policy.h"
 #include "intrusive_containers.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace galib {
 
-template <typename TCacheKey, typename TCacheValue, unsigned int TMaxLevel> class Cache {
+/// @brief Node layout of the Cache: the value is stored inline, after the hot fields of the node.
+/// Best for small values.
+struct InlineCacheValue {
+    template <typename TCacheValue> using Field = TCacheValue;
+
+    template <typename TCacheValue> static TCacheValue &get(Field<TCacheValue> &field) { return field; }
+    template <typename TCacheValue> static const TCacheValue &get(const Field<TCacheValue> &field) { return field; }
+    template <typename TCacheValue> static size_t coldSize() { return 0; }
+};
+
+/// @brief Node layout of the Cache: the value lives in a separate allocation.
+/// Keeps the nodes small, so that lookups walking the buckets do not pull large values into the CPU cache.
+struct SeparateCacheValue {
+    template <typename TCacheValue> struct Field {
+        Field()
+            : _cold(new TCacheValue()) {}
+
+        TCacheValue &operator*() const { return *_cold; }
+        TCacheValue *operator->() const { return _cold.get(); }
+
+        std::unique_ptr<TCacheValue> _cold;
+    };
+
+    template <typename TCacheValue> static TCacheValue &get(Field<TCacheValue> &field) { return *field; }
+    template <typename TCacheValue> static const TCacheValue &get(const Field<TCacheValue> &field) {
+        return *field;
+    }
+    template <typename TCacheValue> static size_t coldSize() { return sizeof(TCacheValue); }
+};
+
+/// @brief Count-min sketch of the access frequencies (TinyLFU), with 4 bit counters.
+/// The counters are halved after 10 * expectedCount increments, so that old accesses are forgotten.
+class FrequencySketch {
   public:
-    struct KeyValue {
-        TCacheValue data;
+    explicit FrequencySketch(size_t expectedCount = 0) { resize(expectedCount); }
+
+    void resize(size_t expectedCount) {
+        // 16 counters per word and one word per expected value: about 4 counters per row and value.
+        size_t size = 16;
+        while (size < expectedCount) {
+            size <<= 1;
+        }
+        _table.assign(size, 0);
+        _sampleSize = 10 * (expectedCount > 0 ? expectedCount : 1);
+        _additions = 0;
+    }
+
+    void increment(size_t hash) {
+        bool added = false;
+        for (unsigned int i = 0; i < depth; i++) {
+            std::uint64_t &word = _table[wordIndex(hash, i)];
+            unsigned int shift = counterShift(hash, i);
+            if (((word >> shift) & 0xf) < 0xf) {
+                word += std::uint64_t(1) << shift;
+                added = true;
+            }
+        }
+        if (added && ++_additions >= _sampleSize) {
+            age();
+        }
+    }
+
+    /// @returns the estimated frequency, at most 15.
+    unsigned int estimate(size_t hash) const {
+        unsigned int frequency = 0xf;
+        for (unsigned int i = 0; i < depth; i++) {
+            unsigned int counter = (_table[wordIndex(hash, i)] >> counterShift(hash, i)) & 0xf;
+            frequency = counter < frequency ? counter : frequency;
+        }
+        return frequency;
+    }
+
+    /// @brief Halves all the counters.
+    void age() {
+        for (std::uint64_t &word : _table) {
+            word = (word >> 1) & 0x7777777777777777ull;
+        }
+        _additions /= 2;
+    }
+
+  private:
+    static const unsigned int depth = 4;
+
+    // Each row uses a different multiplier, the word is taken from the high bits of the product.
+    static std::uint64_t spread(size_t hash, unsigned int row) {
+        static const std::uint64_t seeds[depth] = {0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull,
+                                                   0x9ae16a3b2f90404full, 0xcbf29ce484222325ull};
+        std::uint64_t h = (static_cast<std::uint64_t>(hash) + seeds[row]) * seeds[row];
+        return h ^ (h >> 29);
+    }
+
+    size_t wordIndex(size_t hash, unsigned int row) const { return spread(hash, row) & (_table.size() - 1); }
+
+    unsigned int counterShift(size_t hash, unsigned int row) const {
+        return static_cast<unsigned int>((spread(hash, row) >> 58) & 0xf) * 4;
+    }
+
+    std::vector<std::uint64_t> _table;
+    size_t _sampleSize = 0;
+    size_t _additions = 0;
+};
+
+namespace detail {
+
+// Unsigned LEB128, used by the snapshots of the Cache.
+inline void appendVarint(std::string &out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline bool readVarint(const char *&pos, const char *end, std::uint64_t &value) {
+    value = 0;
+    for (unsigned int shift = 0; pos < end && shift < 64; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*pos++);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Group of a key in the prefix index of the Cache: the key up to its last separator (included), "" if it has none.
+// Only the string keys have a group.
+inline bool cacheKeyGroup(const std::string &key, char separator, std::string &group) {
+    size_t end = key.rfind(separator);
+    group.assign(key, 0, (end != std::string::npos) ? end + 1 : 0);
+    return true;
+}
+
+template <typename TCacheKey> bool cacheKeyGroup(const TCacheKey &, char, std::string &) { return false; }
+
+inline bool cacheKeyHasPrefix(const std::string &key, const std::string &prefix) {
+    return key.compare(0, prefix.size(), prefix) == 0;
+}
+
+template <typename TCacheKey> bool cacheKeyHasPrefix(const TCacheKey &, const std::string &) { return false; }
+
+} // namespace detail
+
+/// @brief Counter with a single writer (e.g. the thread holding the lock of the cache) that any thread can read.
+/// The updates are a relaxed load and store: no atomic read-modify-write on the hot path.
+template <typename T> class RelaxedCounter {
+  public:
+    RelaxedCounter(T value = 0)
+        : _value(value) {}
+    RelaxedCounter(const RelaxedCounter &) = delete;
+    RelaxedCounter &operator=(const RelaxedCounter &) = delete;
+
+    T get() const { return _value.load(std::memory_order_relaxed); }
+    operator T() const { return get(); }
+
+    void add(T delta) { _value.store(get() + delta, std::memory_order_relaxed); }
+    void sub(T delta) { _value.store(get() - delta, std::memory_order_relaxed); }
+    void operator++(int) { add(1); }
+    void operator--(int) { sub(1); }
+    void operator+=(T delta) { add(delta); }
+    void operator-=(T delta) { sub(delta); }
+
+  private:
+    std::atomic<T> _value;
+};
+
+/// @brief Snapshot of the statistics of a level of the Cache (see Cache::getStats).
+struct CacheLevelStats {
+    std::uint64_t hits = 0;        // gets finding the value in this level
+    std::uint64_t misses = 0;      // gets not finding the value, which is created in this level
+    std::uint64_t inserts = 0;     // values created in this level (misses and puts)
+    std::uint64_t promotions = 0;  // values moved from this level to a previous level
+    std::uint64_t demotions = 0;   // values moved from this level to the next level
+    std::uint64_t evictions = 0;   // values evicted from this level
+    std::uint64_t expirations = 0; // values of this level whose time to live has passed
+    std::uint64_t count = 0;
+    std::uint64_t memUsage = 0;
+
+    CacheLevelStats &operator+=(const CacheLevelStats &other) {
+        hits += other.hits;
+        misses += other.misses;
+        inserts += other.inserts;
+        promotions += other.promotions;
+        demotions += other.demotions;
+        evictions += other.evictions;
+        expirations += other.expirations;
+        count += other.count;
+        memUsage += other.memUsage;
+        return *this;
+    }
+};
+
+/// @brief Histogram of latencies: bucket i counts the latencies in [2^i, 2^(i+1)) nanoseconds (bucket 0: < 2ns).
+struct CacheLatencyHistogram {
+    static const unsigned int bucketCount = 64;
+
+    std::uint64_t buckets[bucketCount] = {};
+
+    static unsigned int bucketOf(std::uint64_t nanos) {
+        unsigned int bucket = 0;
+        while (nanos > 1) {
+            nanos >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    std::uint64_t total() const {
+        std::uint64_t sum = 0;
+        for (unsigned int i = 0; i < bucketCount; i++) {
+            sum += buckets[i];
+        }
+        return sum;
+    }
+
+    /// @returns the upper bound in nanoseconds of the bucket holding the percentile p (0..100), 0 if empty.
+    std::uint64_t percentile(double p) const {
+        std::uint64_t sum = total();
+        std::uint64_t rank = static_cast<std::uint64_t>(sum * p / 100.0);
+        std::uint64_t seen = 0;
+        for (unsigned int i = 0; i < bucketCount && sum > 0; i++) {
+            seen += buckets[i];
+            if (seen > rank || seen == sum) {
+                return (i + 1 < bucketCount) ? (std::uint64_t(1) << (i + 1)) : ~std::uint64_t(0);
+            }
+        }
+        return 0;
+    }
+};
+
+/// @brief Keeps the values of a Cache level out of the heap (see Cache::configureLevelStore): the values entering the
+/// level are packed into the store, the values leaving it are unpacked. A location identifies a packed value, it is
+/// kept in the node of the value instead of the value itself.
+template <typename TCacheValue> class CacheLevelStore {
+  public:
+    virtual ~CacheLevelStore() {}
+
+    /// @brief Stores the value and resets it to free its memory.
+    /// @returns false if the value cannot be stored, it then stays in memory.
+    virtual bool pack(TCacheValue &value, std::uint64_t &location) = 0;
+    /// @brief Reads a packed value back, the location stays valid until it is discarded.
+    virtual bool unpack(std::uint64_t location, TCacheValue &value) const = 0;
+    /// @brief The packed value is not used anymore.
+    virtual void discard(std::uint64_t location) = 0;
+    /// @returns the memory still used by a packed value, added to estimateMemSize.
+    virtual size_t memSize(std::uint64_t) const { return 0; }
+    /// @brief Checked after discard: if true, the cache calls compact with the locations of all its packed values.
+    virtual bool needsCompaction() const { return false; }
+    /// @brief Rewrites the store with only the given values, updating their locations.
+    virtual void compact(std::uint64_t *const *, size_t) {}
+};
+
+/// @brief Operations of a Cache recorded by a CacheTraceSink. find is not recorded: it does not change the cache.
+enum class CacheTraceOp : unsigned char { get, touch, put, remove };
+
+/// @brief Receives the operations of a Cache (see Cache::configureTrace and CacheTrace, cache_trace.h).
+class CacheTraceSink {
+  public:
+    virtual ~CacheTraceSink() {}
 
-        // Used by the intrusive dictionary
+    /// @param hash hash of the key.
+    /// @param memSize estimated memory size of the value after the operation, 0 if there is no value.
+    virtual void record(CacheTraceOp op, size_t hash, size_t memSize) = 0;
+};
+
+/// @tparam TPolicy replacement policy of every level: LruPolicy, SlruPolicy, TwoQPolicy, ArcPolicy or ClockPolicy
+/// (cache_policy.h).
+template <typename TCacheKey, typename TCacheValue, unsigned int TMaxLevel, typename TValueLayout = InlineCacheValue,
+          typename TPolicy = LruPolicy>
+class Cache {
+  public:
+    typedef TCacheKey key_type;
+    typedef TCacheValue value_type;
+    static const unsigned int levelCount = TMaxLevel;
+
+    struct Group;
+
+    struct KeyValue {
+        // Hot fields: used by every lookup (bucket walk and key compare) and by the LRU relinking.
+        Link<KeyValue> _dictLink;
+        size_t _hash;
         TCacheKey _key;
+        Link<KeyValue> _listLink;
         size_t _lastMemSize;
+        int _level;
+        // Owned by the replacement policy of the level.
+        unsigned char _segment = 0;
+        // Negative entry: the key does not exist (see Cache::configureNegativeCaching). It has no level and no value.
+        bool _negative = false;
+        // The value is in the store of its level, at _location (see Cache::configureLevelStore).
+        bool _packed = false;
+        // Number of Handles on the value. Only the thread owning the cache adds pins, any thread may release them.
+        std::atomic<unsigned int> _pins{0};
+        // Expiration time (see Cache::currentTime), 0 if the value never expires.
+        std::uint64_t _expiresAt = 0;
+        Link<KeyValue> _timerLink;
+        std::uint64_t _location = 0;
+        // Secondary indexes: the tag of the value (see Cache::setTag) and the group of its key (see
+        // Cache::configurePrefixIndex), null if none.
+        Link<KeyValue> _tagLink;
+        Group *_tagGroup = nullptr;
+        Link<KeyValue> _prefixLink;
+        Group *_prefixGroup = nullptr;
 
-        Link<KeyValue> _listLink;
-        Link<KeyValue> _dictLink;
+        // Cold field: the value (inline or in a separate allocation, see TValueLayout).
+        typename TValueLayout::template Field<TCacheValue> data;
+
+        TCacheValue &value() { return TValueLayout::template get<TCacheValue>(data); }
+        const TCacheValue &value() const { return TValueLayout::template get<TCacheValue>(data); }
     };
 
+    using CacheValuePolicy = typename TPolicy::template Level<KeyValue>;
     using CacheValueList = List<KeyValue, &KeyValue::_listLink>;
     using CacheValueDict = Dictionary<KeyValue, TCacheKey, &KeyValue::_key, &KeyValue::_dictLink>;
+    using CacheValueTimers = TimerWheel<KeyValue, &KeyValue::_expiresAt, &KeyValue::_timerLink>;
+
+    /// @brief Values sharing a tag, or the keys sharing a prefix group. Deleted when it is empty.
+    struct Group {
+        Link<Group> _dictLink;
+        std::string _name;
+        List<KeyValue, &KeyValue::_tagLink> _tagged;
+        List<KeyValue, &KeyValue::_prefixLink> _prefixed;
+    };
+
+    using CacheGroupDict = Dictionary<Group, std::string, &Group::_name, &Group::_dictLink>;
 
     struct CacheLevel {
-        CacheValueList _list;
-        CacheValueDict _dict;
+        CacheLevel() { _policy.configure(_maxCount); }
+
+        CacheValuePolicy _policy;
 
-        unsigned int _count = 0;
+        RelaxedCounter<unsigned int> _count;
         unsigned int _maxCount = 1024 * 16;
 
-        size_t _memUsage = 0;
+        RelaxedCounter<size_t> _memUsage;
         size_t _maxMemUsage = 1024 * 1024 * 32;
 
+        // Set by configureLevel. The default limits of the last level never evict: only the explicit ones do.
+        bool _limited = false;
+
+        // Where the values of the level are kept, null if they stay in memory.
+        CacheLevelStore<TCacheValue> *_store = nullptr;
+
         bool isOverCapacity() const { return (_count > _maxCount) || (_memUsage > _maxMemUsage); }
+        bool isAtCapacity() const { return (_count >= _maxCount) || (_memUsage >= _maxMemUsage); }
+
+        // Statistics, see CacheLevelStats.
+        RelaxedCounter<std::uint64_t> _hits;
+        RelaxedCounter<std::uint64_t> _misses;
+        RelaxedCounter<std::uint64_t> _inserts;
+        RelaxedCounter<std::uint64_t> _promotions;
+        RelaxedCounter<std::uint64_t> _demotions;
+        RelaxedCounter<std::uint64_t> _evictions;
+        RelaxedCounter<std::uint64_t> _expirations;
+    };
+
+    /// @brief Reference to a value of the cache that pins it: the value is not evicted, demoted or deleted until all
+    /// the handles on it are released. A value removed (or expired) while pinned is only unlinked from the cache, the
+    /// readers keep sharing it without copies until the last handle is released.
+    /// A handle can be copied, moved and released by any thread, but must be obtained from the thread owning the cache
+    /// (e.g. inside ShardedCache::apply) and released before the cache is destroyed.
+    class Handle {
+      public:
+        Handle()
+            : _kv(nullptr) {}
+        explicit Handle(KeyValue *kv)
+            : _kv(kv) {
+            if (_kv != nullptr) {
+                _kv->_pins.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Handle(const Handle &other)
+            : Handle(other._kv) {}
+        Handle(Handle &&other)
+            : _kv(other._kv) {
+            other._kv = nullptr;
+        }
+        ~Handle() { reset(); }
+
+        Handle &operator=(Handle other) {
+            std::swap(_kv, other._kv);
+            return *this;
+        }
+
+        void reset() {
+            if (_kv != nullptr) {
+                _kv->_pins.fetch_sub(1, std::memory_order_release);
+                _kv = nullptr;
+            }
+        }
+
+        explicit operator bool() const { return _kv != nullptr; }
+        const TCacheValue &operator*() const { return _kv->value(); }
+        const TCacheValue *operator->() const { return &_kv->value(); }
+        const TCacheValue *get() const { return _kv != nullptr ? &_kv->value() : nullptr; }
+        const TCacheKey &key() const { return _kv->_key; }
+
+      private:
+        KeyValue *_kv;
     };
 
   public:
-    virtual ~Cache() {}
+    virtual ~Cache() {
+        clear();
+        assert(_zombies.isEmpty() && "all the handles must be released before the cache is destroyed");
+    }
 
+    /// @brief Limits of a level. The values over the limits are moved to the next level,
+    /// or evicted from the cache for the last level. The last level is unlimited until it is configured.
     void configureLevel(int level, unsigned int maxCount, size_t maxMemUsage) {
         if (level >= 0 && level < TMaxLevel) {
             _levels[level]._maxCount = maxCount;
             _levels[level]._maxMemUsage = maxMemUsage;
+            _levels[level]._limited = true;
+            _levels[level]._policy.configure(maxCount);
+        }
+    }
+
+    /// @brief Hard limits for all the levels together. When they are exceeded the values are evicted,
+    /// starting with the least recently used values of the last level. Unlimited by default.
+    /// Lowering the limits evicts the values over them immediately.
+    void configureCapacity(size_t maxCount, size_t maxMemUsage) {
+        _maxTotalCount = maxCount;
+        _maxTotalMemUsage = maxMemUsage;
+        ensureLevelLimits(TMaxLevel - 1, nullptr);
+    }
+
+    /// @brief Keeps the values of the level in a store (e.g. CacheSpillFile, cache_spill.h) instead of the heap:
+    /// the values demoted into the level are packed, only their location stays in memory. A value of the level that is
+    /// accessed is unpacked and promoted to level 0, and the new values are never inserted in it. Level 0 cannot have a
+    /// store, and the store can only be changed while the level is empty. onEvict and onExpire see packed values reset.
+    /// @returns false if the store cannot be set.
+    bool configureLevelStore(int level, CacheLevelStore<TCacheValue> *store) {
+        if (level <= 0 || level >= TMaxLevel || _levels[level]._count > 0) {
+            return false;
+        }
+        _levels[level]._store = store;
+        return true;
+    }
+
+    /// @brief Allocates the index for count values (and negative entries) up front: it then never grows while the
+    /// cache holds at most count of them.
+    void reserve(size_t count) { _dict.rehash(2 * count); }
+
+    size_t getMaxTotalCount() const { return _maxTotalCount; }
+    size_t getMaxTotalMemUsage() const { return _maxTotalMemUsage; }
+
+    /// @brief If expireOnGet is true, every get first expires all the values whose time to live has passed.
+    /// Otherwise call expire() (e.g. from a maintenance thread, holding the lock of the cache).
+    /// An expired value is never returned, even if expire() was not called yet.
+    void configureExpiration(bool expireOnGet) { _expireOnGet = expireOnGet; }
+
+    /// @brief Remembers up to maxCount keys for which newCacheValue returned null, for ttl milliseconds (0: until they
+    /// are removed or replaced), so that the following gets of these keys return null without calling newCacheValue.
+    /// The negative entries have their own budget (least recently used first) and are not part of the levels.
+    /// Disabled if maxCount is 0 (the default).
+    void configureNegativeCaching(size_t maxCount, std::uint64_t ttl) {
+        _maxNegativeCount = maxCount;
+        _negativeTtl = ttl;
+        trimNegatives();
+    }
+
+    /// @brief Enables the admission filter (W-TinyLFU) if expectedCount > 0, expectedCount being about the capacity of
+    /// the cache. The new values enter a small admission window (1% of expectedCount, at least one value) counted with
+    /// level 0. Once the cache is full, the value leaving the window only moves to level 0 if it was accessed more
+    /// frequently than the least recently used value of the last level, otherwise it is evicted: a scan of the keys
+    /// does not flush the cache, and a new key accessed again soon is not loaded twice. Disabling the filter moves the
+    /// values of the window to level 0.
+    void configureAdmission(size_t expectedCount) {
+        CacheLevel &window = _levels[windowLevel];
+        if (expectedCount == 0) {
+            _sketch.reset();
+            while (KeyValue *value = window._policy.victim()) {
+                leaveWindow(value);
+            }
+            ensureLevelLimits(0, nullptr);
+            return;
         }
+        if (_sketch) {
+            _sketch->resize(expectedCount);
+        } else {
+            _sketch.reset(new FrequencySketch(expectedCount));
+        }
+        window._maxCount = static_cast<unsigned int>(std::max<size_t>(expectedCount / 100, 1));
+        window._maxMemUsage = static_cast<size_t>(-1);
+        window._policy.configure(window._maxCount);
+        ensureLevelLimits(windowLevel, nullptr);
+    }
+
+    /// @brief Times one getKeyValue every sampleEvery calls (rounded up to a power of 2) in the latency histogram.
+    /// Disabled if sampleEvery is 0 (the default).
+    void configureLatencySampling(unsigned int sampleEvery) {
+        unsigned int mask = 0;
+        while (mask + 1 < sampleEvery) {
+            mask = (mask << 1) | 1;
+        }
+        _latencySampleMask = mask;
+        _sampleLatency = sampleEvery > 0;
+    }
+
+    /// @brief Counts the hits of each level in getStats (the default). Without it, a hit that stays in its level only
+    /// writes what its policy needs (nothing for a value already referenced with ClockPolicy), plus the admission
+    /// filter, the trace and the latency sampling when they are enabled. The misses are still counted.
+    /// A CacheBudgetMember needs the hits: without them, the cache shows none and the budget moves to the other caches
+    /// (or is split evenly if none counts its hits).
+    void configureHitStats(bool enabled) { _countHits = enabled; }
+
+    /// @brief Records the gets, touches, puts and removes in the trace (null to stop). The trace must outlive the
+    /// cache or be reset before it is destroyed.
+    void configureTrace(CacheTraceSink *trace) { _trace = trace; }
+
+    /// @brief The values of the admission window (see configureAdmission) are counted with level 0.
+    unsigned int getCount(int level) const {
+        if (level < 0 || level >= TMaxLevel) {
+            return 0;
+        }
+        return _levels[level]._count.get() + ((level == 0) ? _levels[windowLevel]._count.get() : 0);
+    }
+
+    size_t getMemUsage(int level) const {
+        if (level < 0 || level >= TMaxLevel) {
+            return 0;
+        }
+        return _levels[level]._memUsage.get() + ((level == 0) ? _levels[windowLevel]._memUsage.get() : 0);
+    }
+
+    /// @brief Statistics of the level, since the cache was created. The ones of level 0 include the admission window.
+    /// Can be called from any thread, even while another thread uses the cache.
+    CacheLevelStats getStats(int level) const {
+        CacheLevelStats stats;
+        if (level >= 0 && level < TMaxLevel) {
+            addStats(_levels[level], stats);
+            if (level == 0) {
+                addStats(_levels[windowLevel], stats);
+            }
+        }
+        return stats;
+    }
+
+    /// @brief Sampled latencies of getKeyValue (see configureLatencySampling). Can be called from any thread.
+    CacheLatencyHistogram getLatencyHistogram() const {
+        CacheLatencyHistogram histogram;
+        for (unsigned int i = 0; i < CacheLatencyHistogram::bucketCount; i++) {
+            histogram.buckets[i] = _latencies[i];
+        }
+        return histogram;
+    }
+
+    size_t getTotalCount() const {
+        size_t count = 0;
+        for (unsigned int i = 0; i <= TMaxLevel; i++) {
+            count += _levels[i]._count;
+        }
+        return count;
+    }
+
+    size_t getNegativeCount() const { return _negativeCount; }
+
+    size_t getTotalMemUsage() const {
+        size_t memUsage = 0;
+        for (unsigned int i = 0; i <= TMaxLevel; i++) {
+            memUsage += _levels[i]._memUsage;
+        }
+        return memUsage;
     }
 
   protected:
     virtual KeyValue *newCacheValue(const TCacheKey &, int) { return new KeyValue(); }
 
+    /// @brief Allocates the node of a value inserted with put(). Counterpart of deleteCacheValue.
+    virtual KeyValue *newKeyValue() { return new KeyValue(); }
+
+    /// @brief Number of nodes newKeyValue can still allocate without evicting, for subclasses recycling a fixed number
+    /// of nodes (see StaticCache). Unlimited by default.
+    virtual size_t getNodeBudget() const { return static_cast<size_t>(-1); }
+
     virtual void onCacheLevelChanged(KeyValue *, int, int) {}
 
-    virtual size_t estimateMemSize(KeyValue *) { return sizeof(KeyValue); }
+    /// @brief Called when a value is evicted (not removed), before it is deleted.
+    virtual void onEvict(KeyValue *) {}
+
+    /// @brief Called when the time to live of a value has passed, before it is deleted.
+    virtual void onExpire(KeyValue *) {}
+
+    /// @brief Counterpart of newCacheValue. Subclasses overriding it must call clear() in their destructor.
+    virtual void deleteCacheValue(KeyValue *kv) { delete kv; }
+
+    virtual size_t estimateMemSize(KeyValue *) {
+        return sizeof(KeyValue) + TValueLayout::template coldSize<TCacheValue>();
+    }
+
+    /// @brief Evicts the least recently used negative entry, or else the next victim of the deepest level that has one
+    /// not pinned. For subclasses recycling a fixed number of nodes (see StaticCache).
+    /// @returns false if there is nothing to evict.
+    bool evictOne() {
+        if (KeyValue *negative = _negatives.tail()) {
+            detach(negative);
+            deleteCacheValue(negative);
+            return true;
+        }
+        return evictVictim();
+    }
+
+    /// @brief Time in milliseconds used for the time to live of the values. Only called for values with a ttl.
+    virtual std::uint64_t currentTime() const {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              std::chrono::steady_clock::now().time_since_epoch())
+                                              .count());
+    }
 
   public:
     TCacheValue find(const TCacheKey &key) const {
         KeyValue *value = findKeyValue(key);
-        if (value != nullptr) {
-            return value->data;
+        if (value != nullptr && !value->_negative && !isExpired(value)) {
+            if (value->_packed) {
+                TCacheValue copy;
+                _levels[value->_level]._store->unpack(value->_location, copy);
+                return copy;
+            }
+            return value->value();
         }
         return TCacheValue();
     }
 
+    /// @returns null for the values packed in a store (see configureLevelStore), unlike find.
     TCacheValue *findPtr(const TCacheKey &key) const {
         KeyValue *value = findKeyValue(key);
-        if (value != nullptr) {
-            return &value->data;
+        if (value != nullptr && !value->_negative && !value->_packed && !isExpired(value)) {
+            return &value->value();
         }
         return nullptr;
     }
 
-    TCacheValue get(const TCacheKey &key, int levelIndex = -1) {
-        KeyValue *kv = getKeyValue(key, levelIndex);
+    /// @param ttl time to live in milliseconds of the value if it is created by this call (0: never expires).
+    TCacheValue get(const TCacheKey &key, int levelIndex = -1, std::uint64_t ttl = 0) {
+        KeyValue *kv = getKeyValue(key, levelIndex, ttl);
         if (kv != nullptr) {
-            return kv->data;
+            return kv->value();
         }
         return TCacheValue();
     }
 
-    TCacheValue *getPtr(const TCacheKey &key, int levelIndex = -1) {
-        KeyValue *kv = getKeyValue(key, levelIndex);
+    TCacheValue *getPtr(const TCacheKey &key, int levelIndex = -1, std::uint64_t ttl = 0) {
+        KeyValue *kv = getKeyValue(key, levelIndex, ttl);
         if (kv != nullptr) {
-            return &(kv->data);
+            return &(kv->value());
         }
         return nullptr;
     }
 
-    KeyValue *getKeyValue(const TCacheKey &key, int levelIndex = -1) {
+    /// @brief Like get, but the value is not copied: it is pinned by the returned handle.
+    Handle getHandle(const TCacheKey &key, int levelIndex = -1, std::uint64_t ttl = 0) {
+        return Handle(getKeyValue(key, levelIndex, ttl));
+    }
+
+    /// @brief Like find, but the value is not copied: it is pinned by the returned handle.
+    /// Empty for the values packed in a store, like findPtr.
+    Handle findHandle(const TCacheKey &key) {
+        KeyValue *value = findKeyValue(key);
+        if (value != nullptr && !value->_negative && !value->_packed && !isExpired(value)) {
+            return Handle(value);
+        }
+        return Handle();
+    }
+
+    /// @brief Number of values removed from the cache but not deleted yet because they are pinned.
+    size_t getZombieCount() const { return _zombieCount; }
+
+    /// @brief Deletes the removed values whose handles were all released. Called by the functions changing the cache.
+    void sweepZombies() {
+        KeyValue *value = _zombies.head();
+        while (value != nullptr) {
+            KeyValue *next = _zombies.next(value);
+            if (!isPinned(value)) {
+                value->_listLink.unlink();
+                _zombieCount--;
+                deleteCacheValue(value);
+            }
+            value = next;
+        }
+    }
+
+    KeyValue *getKeyValue(const TCacheKey &key, int levelIndex = -1, std::uint64_t ttl = 0) {
+        if (!_sampleLatency || (++_lookupCount & _latencySampleMask) != 0) {
+            return traced(CacheTraceOp::get, key, lookup(key, levelIndex, ttl, true));
+        }
+        auto start = std::chrono::steady_clock::now();
+        KeyValue *value = lookup(key, levelIndex, ttl, true);
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        _latencies[CacheLatencyHistogram::bucketOf(static_cast<std::uint64_t>(nanos.count()))]++;
+        return traced(CacheTraceOp::get, key, value);
+    }
+
+    /// @brief Like getKeyValue, but a missing value is not created: returns null.
+    KeyValue *touch(const TCacheKey &key, int levelIndex = -1) {
+        return traced(CacheTraceOp::touch, key, lookup(key, levelIndex, 0, false));
+    }
+
+  private:
+    KeyValue *traced(CacheTraceOp op, const TCacheKey &key, KeyValue *value) {
+        if (_trace != nullptr) {
+            size_t hash = (value != nullptr) ? value->_hash : typename CacheValueDict::hasher()(key);
+            _trace->record(op, hash, (value != nullptr) ? value->_lastMemSize : 0);
+        }
+        return value;
+    }
+
+    // created is set if the value did not exist.
+    KeyValue *lookup(const TCacheKey &key, int levelIndex, std::uint64_t ttl, bool create, bool *created = nullptr) {
+        if (_zombieCount > 0) {
+            sweepZombies();
+        }
+        if (_expireOnGet && _timers) {
+            expire(currentTime());
+        }
+
         // Find the value
-        int oldLevelIndex = -1;
-        KeyValue *value = findKeyValue(key, &oldLevelIndex);
+        size_t hash = typename CacheValueDict::hasher()(key);
+        KeyValue *value = _dict.get(key, hash);
+        if (value != nullptr && isExpired(value)) {
+            expireValue(value);
+            value = nullptr;
+        }
+        if (value != nullptr && value->_negative) {
+            // Known to be missing
+            if (create) {
+                _negatives.insertHead(value);
+            }
+            return nullptr;
+        }
+        if (value != nullptr && value->_packed && !unpackValue(value)) {
+            // The value cannot be read back from the store: it is lost.
+            evict(value);
+            value = nullptr;
+        }
+        if (_sketch) {
+            _sketch->increment(hash);
+        }
 
-        if (levelIndex < 0) {
-            if (oldLevelIndex >= 0) {
-                levelIndex = oldLevelIndex;
-            } else {
-                levelIndex = 0;
+        // A value read from a store moves to level 0 (see chooseLevel)
+        levelIndex = chooseLevel(value, levelIndex);
+        if (value != nullptr) {
+            if (_countHits) {
+                _levels[value->_level]._hits++;
+            }
+        } else {
+            _levels[levelIndex]._misses++;
+            if (!create) {
+                return nullptr;
             }
-        } else if (levelIndex >= TMaxLevel) {
-            levelIndex = TMaxLevel - 1;
         }
 
         if (value == nullptr) {
             // The key does not exist
-            value = newCacheValue(key, levelIndex);
+            value = newCacheValue(key, (levelIndex == windowLevel) ? 0 : levelIndex);
 
             // Check that the file exists
             if (value == nullptr) {
+                insertNegative(key, hash);
                 return nullptr;
             }
 
-            value->_key = key;
-            value->_lastMemSize = estimateMemSize(value);
-
-            CacheLevel &lvl = _levels[levelIndex];
-            lvl._list.insertHead(value);
-            lvl._dict.put(value);
-            lvl._count++;
-            lvl._memUsage += value->_lastMemSize;
-
-            ensureLevelLimits(levelIndex);
+            insertKeyValue(value, key, hash, levelIndex, ttl);
+            if (created != nullptr) {
+                *created = true;
+            }
+        } else if (value->_level == levelIndex || isPinned(value)) {
+            // A pinned value stays in its level: onCacheLevelChanged could change it while it is read.
+            _levels[value->_level]._policy.touch(value);
         } else {
-            // The level of the object has maybe changed
-            CacheLevel &lvl = _levels[oldLevelIndex];
-            value->_listLink.unlink();
+            // Move the item to a new level, the dictionary is not touched
+            changeLevel(value, levelIndex);
+            ensureLevelLimits(levelIndex, value);
+        }
 
-            if (oldLevelIndex == levelIndex) {
-                // Move the item to the head of the list
-                lvl._list.insertHead(value);
-            } else {
-                // Move the item to a new level
-                value->_dictLink.unlink();
-                lvl._count--;
-                lvl._memUsage -= value->_lastMemSize;
+        return value;
+    }
 
-                onCacheLevelChanged(value, oldLevelIndex, levelIndex);
-                value->_lastMemSize = estimateMemSize(value);
+  public:
+    /// @brief Same as out[i] = get(keys[i], levelIndex) for each key, in one pass over the batch. For every 16 keys:
+    /// the hashes are computed and the buckets prefetched together, the hits are copied and relinked, then the missing
+    /// keys are created (a miss can evict values, so the hits of the batch are relinked before).
+    /// @returns the number of keys found in the cache (the others were created).
+    size_t getMany(const TCacheKey *keys, size_t count, TCacheValue *out, int levelIndex = -1) {
+        if (_expireOnGet && _timers) {
+            expire(currentTime());
+        }
+        if (_zombieCount > 0) {
+            sweepZombies();
+        }
 
-                CacheLevel &newLvl = _levels[levelIndex];
-                newLvl._list.insertHead(value);
-                newLvl._dict.put(value);
-                newLvl._count++;
-                lvl._memUsage += value->_lastMemSize;
+        const size_t batchSize = 16;
+        size_t hashes[batchSize];
+        KeyValue *values[batchSize];
+        size_t hits = 0;
+        for (size_t first = 0; first < count; first += batchSize) {
+            size_t n = (count - first < batchSize) ? count - first : batchSize;
+            for (size_t i = 0; i < n; i++) {
+                hashes[i] = typename CacheValueDict::hasher()(keys[first + i]);
+                _dict.prefetch(hashes[i]);
+            }
+            for (size_t i = 0; i < n; i++) {
+                KeyValue *value = _dict.get(keys[first + i], hashes[i]);
+                bool simpleHit = (value != nullptr) && !value->_negative && !value->_packed && !isExpired(value);
+                if (simpleHit && levelIndex >= 0) {
+                    // Moving the value to another level goes through getKeyValue.
+                    simpleHit = value->_level == ((levelIndex < TMaxLevel) ? levelIndex : TMaxLevel - 1);
+                }
+                values[i] = simpleHit ? value : nullptr;
+            }
 
-                ensureLevelLimits(levelIndex);
+            for (size_t i = 0; i < n; i++) {
+                if (KeyValue *value = values[i]) {
+                    out[first + i] = value->value();
+                    if (_sketch) {
+                        _sketch->increment(hashes[i]);
+                    }
+                    if (_trace != nullptr) {
+                        _trace->record(CacheTraceOp::get, hashes[i], value->_lastMemSize);
+                    }
+                    CacheLevel &lvl = _levels[value->_level];
+                    if (_countHits) {
+                        lvl._hits++;
+                    }
+                    lvl._policy.touch(value);
+                    hits++;
+                }
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (values[i] == nullptr) {
+                    bool created = false;
+                    KeyValue *value = traced(CacheTraceOp::get, keys[first + i],
+                                             lookup(keys[first + i], levelIndex, 0, true, &created));
+                    out[first + i] = (value != nullptr) ? value->value() : TCacheValue();
+                    hits += (value != nullptr && !created) ? 1 : 0;
+                }
             }
         }
+        return hits;
+    }
 
-        return value;
+    /// @brief Inserts a value that was built outside of the cache (e.g. loaded by another thread without holding the
+    /// lock of the cache), replacing the current value of the key. newCacheValue is not called.
+    /// @returns the inserted node, valid until the next call changing the cache.
+    KeyValue *put(const TCacheKey &key, TCacheValue data, int levelIndex = -1, std::uint64_t ttl = 0) {
+        if (_zombieCount > 0) {
+            sweepZombies();
+        }
+        size_t hash = typename CacheValueDict::hasher()(key);
+        if (KeyValue *old = _dict.get(key, hash)) {
+            detach(old);
+            dispose(old);
+        }
+        if (_sketch) {
+            _sketch->increment(hash);
+        }
+
+        levelIndex = chooseLevel(nullptr, levelIndex);
+
+        KeyValue *value = newKeyValue();
+        value->value() = std::move(data);
+        insertKeyValue(value, key, hash, levelIndex, ttl);
+        return traced(CacheTraceOp::put, key, value);
     }
 
     void remove(const TCacheKey &key) {
-        int levelIndex = -1;
-        KeyValue *value = findKeyValue(key, &levelIndex);
+        KeyValue *value = findKeyValue(key);
         if (value != nullptr) {
-            _levels[levelIndex]._count--;
-            _levels[levelIndex]._memUsage -= value->_lastMemSize;
-            delete value;
+            detach(value);
+            dispose(value);
+        }
+        traced(CacheTraceOp::remove, key, nullptr);
+    }
+
+    /// @brief Deletes the values (and the negative entries) whose time to live has passed at now.
+    /// @returns the number of expired values.
+    size_t expire(std::uint64_t now) {
+        if (!_timers) {
+            return 0;
+        }
+        return _timers->advance(now, [this](KeyValue *kv) { expireValue(kv); });
+    }
+
+    /// @brief Appends a snapshot of the values to out: the keys, levels, remaining time to live and values, in the
+    /// order of the replacement policy of each level (see deserialize). The negative entries are not saved.
+    /// The serializer writes the bytes of the keys and the values, the cache frames them:
+    /// struct Serializer {
+    ///     void writeKey(const TCacheKey &key, std::string &out);
+    ///     void writeValue(const TCacheValue &value, std::string &out);
+    ///     bool readKey(const char *data, size_t size, TCacheKey &key);
+    ///     bool readValue(const char *data, size_t size, TCacheValue &value);
+    /// };
+    /// See cache_snapshot.h to save and load snapshots as files.
+    template <typename TSerializer> void serialize(std::string &out, TSerializer &serializer) const {
+        std::uint64_t now = _timers ? currentTime() : 0;
+        out.append(snapshotMagic(), snapshotMagicSize);
+        // The admission window is saved last, as the most recent values of level 0.
+        for (unsigned int i = 0; i <= TMaxLevel; i++) {
+            _levels[i]._policy.forEach([&](const KeyValue *value) {
+                if (value->_expiresAt != 0 && value->_expiresAt <= now) {
+                    return;
+                }
+                detail::appendVarint(out, (i < TMaxLevel) ? i : 0);
+                detail::appendVarint(out, value->_expiresAt != 0 ? value->_expiresAt - now : 0);
+                appendFramed(out, [&](std::string &bytes) { serializer.writeKey(value->_key, bytes); });
+                appendFramed(out, [&](std::string &bytes) {
+                    if (!value->_packed) {
+                        serializer.writeValue(value->value(), bytes);
+                        return;
+                    }
+                    TCacheValue unpacked;
+                    _levels[i]._store->unpack(value->_location, unpacked);
+                    serializer.writeValue(unpacked, bytes);
+                });
+            });
+        }
+    }
+
+    /// @brief Replaces the values of the cache with the ones of a snapshot written by serialize.
+    /// The snapshot is read and checked first, then the nodes are built (newCacheValue is not called), the index is
+    /// built in bulk and the values are linked to their levels in their saved order. The current limits are applied
+    /// once all the values are loaded. If the subclass cannot allocate that many nodes (see getNodeBudget), only the
+    /// most recent values are loaded.
+    /// @returns false if the snapshot is not valid (including a duplicated key), in that case the cache is not
+    /// changed.
+    template <typename TSerializer> bool deserialize(const char *data, size_t size, TSerializer &serializer) {
+        const char *pos = data;
+        const char *end = data + size;
+        if (size < snapshotMagicSize || std::string(data, snapshotMagicSize) != snapshotMagic()) {
+            return false;
+        }
+        pos += snapshotMagicSize;
+
+        // Read in temporary records: no node is allocated (or recycled) before the snapshot is known to be valid.
+        std::vector<SnapshotRecord> records;
+        while (pos < end) {
+            records.emplace_back();
+            SnapshotRecord &record = records.back();
+            std::uint64_t level = 0;
+            bool valid = detail::readVarint(pos, end, level) && level < TMaxLevel &&
+                         detail::readVarint(pos, end, record._ttl) &&
+                         readFramed(pos, end, [&](const char *bytes, size_t n) {
+                             return serializer.readKey(bytes, n, record._key);
+                         }) &&
+                         readFramed(pos, end, [&](const char *bytes, size_t n) {
+                             return serializer.readValue(bytes, n, record._value);
+                         });
+            if (!valid) {
+                return false;
+            }
+            record._level = static_cast<int>(level);
+            record._hash = typename CacheValueDict::hasher()(record._key);
+        }
+        if (hasDuplicateKeys(records)) {
+            return false;
+        }
+
+        clear();
+        // The least recent values are dropped first: the deepest levels, from their victim (see serialize).
+        size_t budget = getNodeBudget();
+        for (int level = TMaxLevel - 1; level >= 0 && records.size() > budget; level--) {
+            size_t dropCount = records.size() - budget;
+            for (size_t i = 0; i < records.size() && dropCount > 0; i++) {
+                if (records[i]._level == level) {
+                    records[i]._level = -1;
+                    dropCount--;
+                }
+            }
+            records.erase(std::remove_if(records.begin(), records.end(),
+                                         [](const SnapshotRecord &record) { return record._level < 0; }),
+                          records.end());
+        }
+        std::vector<KeyValue *> values;
+        values.reserve(records.size());
+        for (SnapshotRecord &record : records) {
+            KeyValue *value = newKeyValue();
+            value->_key = std::move(record._key);
+            value->value() = std::move(record._value);
+            value->_hash = record._hash;
+            value->_level = record._level;
+            values.push_back(value);
+        }
+        _dict.bulkLoad(values.begin(), values.end(), true);
+        for (size_t i = 0; i < values.size(); i++) {
+            KeyValue *value = values[i];
+            if (_levels[value->_level]._store != nullptr) {
+                packValue(value, value->_level);
+            }
+            value->_lastMemSize = memSizeOf(value, value->_level);
+            value->_expiresAt = 0;
+            if (records[i]._ttl > 0) {
+                value->_expiresAt = currentTime() + records[i]._ttl;
+                timers().schedule(value);
+            }
+            linkToLevel(value, value->_level);
+            linkToPrefixGroup(value);
+        }
+        ensureLevelLimits(0, nullptr);
+        return true;
+    }
+
+    /// @brief Tags the value of the key (e.g. with its tenant or its source file), replacing its previous tag, so that
+    /// all the values with the tag can be removed at once with invalidateTag. An empty tag removes the tag.
+    /// A value has a single tag. The negative entries can be tagged too, so that the misses cached for a source are
+    /// invalidated with its values. The tags are not part of the snapshots.
+    /// @returns false if the key is not in the cache.
+    bool setTag(const TCacheKey &key, const std::string &tag) {
+        KeyValue *value = findKeyValue(key);
+        if (value == nullptr) {
+            return false;
+        }
+        untag(value);
+        if (tag.empty()) {
+            return true;
+        }
+        Group *group = _tags.get(tag);
+        if (group == nullptr) {
+            group = new Group();
+            group->_name = tag;
+            _tags.put(group);
+        }
+        group->_tagged.insertTail(value);
+        value->_tagGroup = group;
+        return true;
+    }
+
+    /// @brief Removes all the values (and negative entries) with the tag, in a time proportional to their number.
+    /// @returns the number of removed values and negative entries.
+    size_t invalidateTag(const std::string &tag) {
+        std::vector<KeyValue *> values;
+        if (Group *group = _tags.get(tag)) {
+            for (KeyValue *value = group->_tagged.head(); value != nullptr; value = group->_tagged.next(value)) {
+                values.push_back(value);
+            }
+        }
+        return removeValues(values);
+    }
+
+    /// @brief Indexes the string keys by their prefix up to the last separator (e.g. '/' for paths: "/a/b/" for
+    /// "/a/b/c"), so that invalidatePrefix only visits the keys of the matching groups. 0 disables the index.
+    /// Indexing a key costs a lookup in an ordered map of the groups. The negative entries are indexed too.
+    void configurePrefixIndex(char separator) {
+        forEachEntry([&](KeyValue *value) { unlinkFromPrefixGroup(value); });
+        _prefixSeparator = separator;
+        forEachEntry([&](KeyValue *value) { linkToPrefixGroup(value); });
+    }
+
+    /// @brief Removes all the values (and negative entries) whose (string) key starts with prefix. With a prefix
+    /// index, only the groups starting with the prefix and the group of the prefix itself are visited; otherwise all
+    /// the values and negative entries are.
+    /// @returns the number of removed values and negative entries.
+    size_t invalidatePrefix(const std::string &prefix) {
+        std::vector<KeyValue *> values;
+        std::string group;
+        if (_prefixSeparator == 0 || !detail::cacheKeyGroup(prefix, _prefixSeparator, group)) {
+            forEachEntry([&](KeyValue *value) {
+                if (detail::cacheKeyHasPrefix(value->_key, prefix)) {
+                    values.push_back(value);
+                }
+            });
+            return removeValues(values);
+        }
+
+        // The keys of the groups starting with the prefix all match.
+        for (auto it = _prefixes.lower_bound(prefix); it != _prefixes.end(); ++it) {
+            if (it->first.compare(0, prefix.size(), prefix) != 0) {
+                break;
+            }
+            const auto &members = it->second->_prefixed;
+            for (KeyValue *value = members.head(); value != nullptr; value = members.next(value)) {
+                values.push_back(value);
+            }
+        }
+        // The prefix does not end with a separator: some keys of its own group match.
+        auto it = _prefixes.find(group);
+        if (group != prefix && it != _prefixes.end()) {
+            const auto &members = it->second->_prefixed;
+            for (KeyValue *value = members.head(); value != nullptr; value = members.next(value)) {
+                if (detail::cacheKeyHasPrefix(value->_key, prefix)) {
+                    values.push_back(value);
+                }
+            }
+        }
+        return removeValues(values);
+    }
+
+    /// @brief Evicts the next victim of the deepest level that has one not pinned, e.g. to enforce limits shared with
+    /// other caches (see ShardedCache::configureCapacity).
+    /// @returns false if there is nothing to evict.
+    bool evictVictim() {
+        // The admission window last, like the hard limits of ensureLevelLimits.
+        for (int i = TMaxLevel; i >= 0; i--) {
+            if (KeyValue *victim = unpinnedVictim(_levels[(i > 0) ? i - 1 : windowLevel], nullptr)) {
+                evict(victim);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Removes and deletes all the values (the pinned values are deleted once their handles are released).
+    void clear() {
+        for (int i = 0; i <= windowLevel; i++) {
+            while (KeyValue *value = _levels[i]._policy.victim()) {
+                detach(value);
+                dispose(value);
+            }
+        }
+        sweepZombies();
+        while (KeyValue *value = _negatives.head()) {
+            detach(value);
+            deleteCacheValue(value);
         }
     }
 
   private:
-    KeyValue *findKeyValue(const TCacheKey &key, int *level = nullptr) const {
-        for (int i = 0; i < TMaxLevel; i++) {
-            KeyValue *value = _levels[i]._dict.get(key);
+    static const size_t snapshotMagicSize = 4;
+    static const char *snapshotMagic() { return "GCS1"; }
+
+    // The bytes written by write, prefixed by their size.
+    template <typename F> static void appendFramed(std::string &out, F write) {
+        std::string bytes;
+        write(bytes);
+        detail::appendVarint(out, bytes.size());
+        out.append(bytes);
+    }
+
+    template <typename F> static bool readFramed(const char *&pos, const char *end, F read) {
+        std::uint64_t size = 0;
+        if (!detail::readVarint(pos, end, size) || size > static_cast<std::uint64_t>(end - pos) ||
+            !read(pos, static_cast<size_t>(size))) {
+            return false;
+        }
+        pos += size;
+        return true;
+    }
+
+    // A value of a snapshot being read by deserialize.
+    struct SnapshotRecord {
+        TCacheKey _key;
+        TCacheValue _value;
+        size_t _hash = 0;
+        int _level = 0;
+        std::uint64_t _ttl = 0;
+    };
+
+    // Sorted by hash, only the records with the same hash are compared.
+    static bool hasDuplicateKeys(const std::vector<SnapshotRecord> &records) {
+        std::vector<const SnapshotRecord *> sorted;
+        sorted.reserve(records.size());
+        for (const SnapshotRecord &record : records) {
+            sorted.push_back(&record);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const SnapshotRecord *a, const SnapshotRecord *b) { return a->_hash < b->_hash; });
+        std::equal_to<TCacheKey> equal;
+        for (size_t first = 0; first < sorted.size(); first++) {
+            for (size_t i = first + 1; i < sorted.size() && sorted[i]->_hash == sorted[first]->_hash; i++) {
+                if (equal(sorted[i]->_key, sorted[first]->_key)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    KeyValue *findKeyValue(const TCacheKey &key) const {
+        return _dict.get(key, typename CacheValueDict::hasher()(key));
+    }
+
+    // Level of the value (null if the key does not exist) when levelIndex is requested.
+    // The new values go to the admission window if the filter is enabled, the window being part of level 0.
+    // The values returned to the caller are never in a level with a store: they go to level 0.
+    int chooseLevel(const KeyValue *value, int levelIndex) const {
+        int level = 0;
+        if (levelIndex < 0) {
             if (value != nullptr) {
-                if (level != nullptr) {
-                    *level = i;
+                level = value->_level;
+            } else if (_sketch) {
+                level = windowLevel;
+            }
+        } else {
+            level = (levelIndex >= TMaxLevel) ? TMaxLevel - 1 : levelIndex;
+            if (level == 0 && value != nullptr && value->_level == windowLevel) {
+                level = windowLevel;
+            }
+        }
+        return (_levels[level]._store != nullptr) ? 0 : level;
+    }
+
+    void insertKeyValue(KeyValue *value, const TCacheKey &key, size_t hash, int levelIndex, std::uint64_t ttl) {
+        value->_key = key;
+        value->_hash = hash;
+        value->_level = levelIndex;
+        value->_lastMemSize = estimateMemSize(value);
+        value->_expiresAt = 0;
+
+        _levels[levelIndex]._inserts++;
+        if (ttl > 0) {
+            value->_expiresAt = currentTime() + ttl;
+            timers().schedule(value);
+        }
+        _dict.put(value, hash);
+        linkToPrefixGroup(value);
+        linkToLevel(value, levelIndex);
+        ensureLevelLimits(levelIndex, value);
+    }
+
+    void linkToLevel(KeyValue *value, int levelIndex, bool atTail = false) {
+        CacheLevel &lvl = _levels[levelIndex];
+        value->_level = levelIndex;
+        lvl._policy.insert(value, atTail);
+        lvl._count++;
+        lvl._memUsage += value->_lastMemSize;
+    }
+
+    // replaced: the value leaves the level because the level is over capacity.
+    void unlinkFromLevel(KeyValue *value, bool replaced = false) {
+        CacheLevel &lvl = _levels[value->_level];
+        lvl._policy.remove(value, replaced);
+        lvl._count--;
+        lvl._memUsage -= value->_lastMemSize;
+    }
+
+    void changeLevel(KeyValue *value, int levelIndex, bool replaced = false) {
+        int oldLevelIndex = value->_level;
+        CacheLevelStore<TCacheValue> *store = _levels[levelIndex]._store;
+        if (value->_packed && store != _levels[oldLevelIndex]._store && !unpackValue(value)) {
+            // The value cannot be read back from the store: it is lost.
+            evict(value);
+            return;
+        }
+        // The admission window is part of level 0 for the statistics and the subclasses.
+        int reportedLevelIndex = (oldLevelIndex == windowLevel) ? 0 : oldLevelIndex;
+        if (levelIndex < reportedLevelIndex) {
+            _levels[oldLevelIndex]._promotions++;
+        } else {
+            _levels[oldLevelIndex]._demotions++;
+        }
+        unlinkFromLevel(value, replaced);
+
+        onCacheLevelChanged(value, reportedLevelIndex, levelIndex);
+        if (store != nullptr && !value->_packed) {
+            packValue(value, levelIndex);
+        }
+        value->_lastMemSize = memSizeOf(value, levelIndex);
+
+        linkToLevel(value, levelIndex);
+    }
+
+    size_t memSizeOf(KeyValue *value, int levelIndex) {
+        size_t memSize = estimateMemSize(value);
+        if (value->_packed) {
+            memSize += _levels[levelIndex]._store->memSize(value->_location);
+        }
+        return memSize;
+    }
+
+    void packValue(KeyValue *value, int levelIndex) {
+        value->_packed = _levels[levelIndex]._store->pack(value->value(), value->_location);
+    }
+
+    // The value stays in its level. Returns false if the store cannot read it, the value is then still packed.
+    bool unpackValue(KeyValue *value) {
+        if (!_levels[value->_level]._store->unpack(value->_location, value->value())) {
+            return false;
+        }
+        discardPacked(value);
+        return true;
+    }
+
+    void discardPacked(KeyValue *value) {
+        CacheLevelStore<TCacheValue> *store = _levels[value->_level]._store;
+        value->_packed = false;
+        store->discard(value->_location);
+        if (store->needsCompaction()) {
+            std::vector<std::uint64_t *> locations;
+            for (unsigned int i = 0; i < TMaxLevel; i++) {
+                if (_levels[i]._store == store) {
+                    _levels[i]._policy.forEach([&](KeyValue *packed) {
+                        if (packed->_packed) {
+                            locations.push_back(&packed->_location);
+                        }
+                    });
                 }
-                return value;
             }
+            store->compact(locations.data(), locations.size());
+        }
+    }
+
+    // Unlinks the value from all the structures of the cache.
+    void detach(KeyValue *value, bool replaced = false) {
+        _dict.remove(value);
+        if (value->_negative) {
+            value->_listLink.unlink();
+            _negativeCount--;
+        } else {
+            unlinkFromLevel(value, replaced);
+            if (value->_packed) {
+                discardPacked(value);
+            }
+        }
+        untag(value);
+        unlinkFromPrefixGroup(value);
+        value->_timerLink.unlink();
+    }
+
+    void insertNegative(const TCacheKey &key, size_t hash) {
+        if (_maxNegativeCount == 0) {
+            return;
+        }
+        KeyValue *value = newKeyValue();
+        value->_key = key;
+        value->_hash = hash;
+        value->_negative = true;
+        value->_level = -1;
+        value->_lastMemSize = 0;
+        value->_expiresAt = 0;
+        if (_negativeTtl > 0) {
+            value->_expiresAt = currentTime() + _negativeTtl;
+            timers().schedule(value);
+        }
+        _dict.put(value, hash);
+        _negatives.insertHead(value);
+        _negativeCount++;
+        linkToPrefixGroup(value);
+        trimNegatives();
+    }
+
+    void trimNegatives() {
+        while (_negativeCount > _maxNegativeCount) {
+            KeyValue *value = _negatives.tail();
+            detach(value);
+            deleteCacheValue(value);
+        }
+    }
+
+    void evict(KeyValue *value) {
+        _levels[value->_level]._evictions++;
+        detach(value, true);
+        onEvict(value);
+        dispose(value);
+    }
+
+    // Calls fn(KeyValue *) for the values of all the levels, then for the negative entries.
+    template <typename F> void forEachEntry(F fn) {
+        for (int i = 0; i <= windowLevel; i++) {
+            _levels[i]._policy.forEach(fn);
+        }
+        for (KeyValue *value = _negatives.head(); value != nullptr; value = _negatives.next(value)) {
+            fn(value);
+        }
+    }
+
+    size_t removeValues(const std::vector<KeyValue *> &values) {
+        if (_zombieCount > 0) {
+            sweepZombies();
+        }
+        for (KeyValue *value : values) {
+            detach(value);
+            if (_trace != nullptr) {
+                _trace->record(CacheTraceOp::remove, value->_hash, 0);
+            }
+            dispose(value);
+        }
+        return values.size();
+    }
+
+    void untag(KeyValue *value) {
+        Group *group = value->_tagGroup;
+        if (group == nullptr) {
+            return;
+        }
+        group->_tagged.remove(value);
+        value->_tagGroup = nullptr;
+        if (group->_tagged.isEmpty()) {
+            _tags.remove(group);
+            delete group;
+        }
+    }
+
+    void linkToPrefixGroup(KeyValue *value) {
+        std::string name;
+        if (_prefixSeparator == 0 || !detail::cacheKeyGroup(value->_key, _prefixSeparator, name)) {
+            return;
+        }
+        std::unique_ptr<Group> &group = _prefixes[name];
+        if (!group) {
+            group.reset(new Group());
+            group->_name = name;
+        }
+        group->_prefixed.insertTail(value);
+        value->_prefixGroup = group.get();
+    }
+
+    void unlinkFromPrefixGroup(KeyValue *value) {
+        Group *group = value->_prefixGroup;
+        if (group == nullptr) {
+            return;
+        }
+        group->_prefixed.remove(value);
+        value->_prefixGroup = nullptr;
+        if (group->_prefixed.isEmpty()) {
+            _prefixes.erase(_prefixes.find(group->_name));
+        }
+    }
+
+    bool isPinned(const KeyValue *value) const { return value->_pins.load(std::memory_order_acquire) != 0; }
+
+    // Deletes a detached value, or keeps it in the zombies until it is not pinned anymore.
+    void dispose(KeyValue *value) {
+        if (isPinned(value)) {
+            _zombies.insertTail(value);
+            _zombieCount++;
+        } else {
+            deleteCacheValue(value);
+        }
+    }
+
+    // The victim of the level that is not pinned. The pinned victims are moved back to the head of their segment.
+    KeyValue *unpinnedVictim(CacheLevel &lvl, KeyValue *keep) {
+        for (unsigned int tries = lvl._count; tries > 0; tries--) {
+            KeyValue *victim = lvl._policy.victim(keep);
+            if (victim == nullptr || !isPinned(victim)) {
+                return victim;
+            }
+            lvl._policy.requeue(victim);
         }
         return nullptr;
     }
 
-    void ensureLevelLimits(int level) {
+    bool isExpired(const KeyValue *value) const {
+        return value->_expiresAt != 0 && value->_expiresAt <= currentTime();
+    }
+
+    void expireValue(KeyValue *value) {
+        if (!value->_negative) {
+            _levels[value->_level]._expirations++;
+        }
+        detach(value);
+        if (!value->_negative) {
+            onExpire(value);
+        }
+        dispose(value);
+    }
+
+    CacheValueTimers &timers() {
+        if (!_timers) {
+            _timers.reset(new CacheValueTimers(currentTime()));
+        }
+        return *_timers;
+    }
+
+    // keep is the value returned to the caller, it is never evicted.
+    void ensureLevelLimits(int level, KeyValue *keep) {
+        if (level == windowLevel) {
+            // The values leaving the admission window compete with the next victim of the last level.
+            CacheLevel &window = _levels[windowLevel];
+            while (window.isOverCapacity()) {
+                KeyValue *candidate = unpinnedVictim(window, keep);
+                if (candidate == nullptr) {
+                    break;
+                }
+                if (!admit(candidate->_hash)) {
+                    evict(candidate);
+                    continue;
+                }
+                leaveWindow(candidate);
+                ensureLevelLimits(0, keep);
+            }
+            level = 0;
+        }
+
         for (int i = level; i < TMaxLevel - 1; i++) {
             CacheLevel &lvl = _levels[i];
-            CacheLevel &nextLvl = _levels[i + 1];
             while (lvl.isOverCapacity() && lvl._count > 1) {
-                // we need to move the last item to next
-                KeyValue *last = lvl._list.tail();
-                last->_listLink.unlink();
-                last->_dictLink.unlink();
-                lvl._count--;
-                lvl._memUsage -= last->_lastMemSize;
+                // we need to move the victim of the policy to next
+                KeyValue *victim = unpinnedVictim(lvl, keep);
+                if (victim == nullptr) {
+                    break;
+                }
+                changeLevel(victim, i + 1, true);
+            }
+        }
 
-                onCacheLevelChanged(last, i, i + 1);
-                last->_lastMemSize = estimateMemSize(last);
+        CacheLevel &lastLvl = _levels[TMaxLevel - 1];
+        while (lastLvl._limited && lastLvl.isOverCapacity()) {
+            KeyValue *victim = unpinnedVictim(lastLvl, keep);
+            if (victim == nullptr) {
+                break;
+            }
+            evict(victim);
+        }
 
-                nextLvl._dict.put(last);
-                nextLvl._list.insertHead(last);
-                nextLvl._count++;
-                nextLvl._memUsage += last->_lastMemSize;
+        // The hard limits: evict from the deepest levels first, the admission window last.
+        for (int i = TMaxLevel; i >= 0 && isOverTotalCapacity(); i--) {
+            CacheLevel &lvl = _levels[(i > 0) ? i - 1 : windowLevel];
+            while (isOverTotalCapacity()) {
+                KeyValue *victim = unpinnedVictim(lvl, keep);
+                if (victim == nullptr) {
+                    break;
+                }
+                evict(victim);
             }
         }
     }
 
+    // Moves a value of the admission window to level 0, which already counts it: no hook, no statistics.
+    void leaveWindow(KeyValue *value) {
+        unlinkFromLevel(value);
+        linkToLevel(value, 0);
+    }
+
+    // A value leaving the admission window is admitted if there is room for it, or if it is more frequent than the
+    // next evicted value.
+    bool admit(size_t hash) const {
+        const CacheLevel &lastLvl = _levels[TMaxLevel - 1];
+        bool isFull = (lastLvl._limited && lastLvl.isAtCapacity()) || (getTotalCount() >= _maxTotalCount) ||
+                      (getTotalMemUsage() >= _maxTotalMemUsage);
+        KeyValue *victim = lastLvl._policy.peekVictim();
+        if (!isFull || victim == nullptr) {
+            return true;
+        }
+        return _sketch->estimate(hash) > _sketch->estimate(victim->_hash);
+    }
+
+    static void addStats(const CacheLevel &lvl, CacheLevelStats &stats) {
+        stats.hits += lvl._hits;
+        stats.misses += lvl._misses;
+        stats.inserts += lvl._inserts;
+        stats.promotions += lvl._promotions;
+        stats.demotions += lvl._demotions;
+        stats.evictions += lvl._evictions;
+        stats.expirations += lvl._expirations;
+        stats.count += lvl._count;
+        stats.memUsage += lvl._memUsage;
+    }
+
+    bool isOverTotalCapacity() const {
+        return (getTotalCount() > _maxTotalCount) || (getTotalMemUsage() > _maxTotalMemUsage);
+    }
+
   private:
-    CacheLevel _levels[TMaxLevel];
+    // A single index for all the levels: the level of a value is stored in KeyValue::_level.
+    CacheValueDict _dict;
+    // The extra level is the admission window (see configureAdmission), empty while the filter is disabled.
+    static const int windowLevel = TMaxLevel;
+    CacheLevel _levels[TMaxLevel + 1];
+
+    size_t _maxTotalCount = static_cast<size_t>(-1);
+    size_t _maxTotalMemUsage = static_cast<size_t>(-1);
+
+    // Only allocated once a value with a time to live is inserted.
+    std::unique_ptr<CacheValueTimers> _timers;
+    bool _expireOnGet = false;
+
+    // Values removed while pinned, deleted by sweepZombies.
+    CacheValueList _zombies;
+    size_t _zombieCount = 0;
+
+    // Negative entries, most recently used first.
+    CacheValueList _negatives;
+    size_t _negativeCount = 0;
+    size_t _maxNegativeCount = 0;
+    std::uint64_t _negativeTtl = 0;
+
+    bool _countHits = true;
+
+    // Latency sampling: one getKeyValue out of _latencySampleMask + 1.
+    bool _sampleLatency = false;
+    unsigned int _latencySampleMask = 0;
+    unsigned int _lookupCount = 0;
+    RelaxedCounter<std::uint64_t> _latencies[CacheLatencyHistogram::bucketCount];
+
+    // Only allocated if the admission filter is enabled.
+    std::unique_ptr<FrequencySketch> _sketch;
+
+    CacheTraceSink *_trace = nullptr;
+
+    // Secondary indexes, the groups are created by their first value.
+    CacheGroupDict _tags;
+    std::map<std::string, std::unique_ptr<Group>> _prefixes;
+    char _prefixSeparator = 0;
 };
 
 } // namespace galib
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace galib {
+
+/// @brief Memory limit shared by several caches. The budget is split between the registered caches and moved
+/// periodically (see rebalance) toward the caches where more memory would bring the most hits.
+/// The marginal value of a cache is estimated with the hits on its last level since the previous rebalance: these are
+/// the values that a smaller cache would have evicted first, and that a bigger cache would keep more of.
+/// Each cache evicts its own values to stay below its share, so the sum of the caches stays below the budget.
+/// @example CacheBudget budget(256 * 1024 * 1024);
+/// CacheBudgetMember<ShardedCache<FileCache>> files(fileCache);
+/// CacheBudgetMember<ShardedCache<ImageCache>> images(imageCache);
+/// budget.add(&files);
+/// budget.add(&images);
+/// ... every few seconds:
+/// budget.rebalance();
+class CacheBudget {
+  public:
+    /// @brief A cache sharing the budget. See CacheBudgetMember.
+    class Member {
+      public:
+        virtual ~Member() {}
+
+        virtual size_t budgetMemUsage() const = 0;
+        /// @returns the number of hits on the last level since the cache was created.
+        virtual std::uint64_t budgetHits() const = 0;
+        /// @brief New memory limit of the cache: the values over it must be evicted.
+        virtual void setBudgetMemUsage(size_t maxMemUsage) = 0;
+    };
+
+  public:
+    /// @param minSharePercent every cache keeps at least this percentage of an even split of the budget,
+    /// so that an idle cache can still show its hits.
+    explicit CacheBudget(size_t maxMemUsage, unsigned int minSharePercent = 25)
+        : _maxMemUsage(maxMemUsage)
+        , _minSharePercent(minSharePercent > 100 ? 100 : minSharePercent) {}
+
+    CacheBudget(const CacheBudget &) = delete;
+    CacheBudget &operator=(const CacheBudget &) = delete;
+
+    /// @brief Registers a cache, the budget is split evenly again. The member must outlive its registration.
+    void add(Member *member) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _members.push_back(Share{member, member->budgetHits(), 0});
+        splitEvenly();
+    }
+
+    void remove(Member *member) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < _members.size(); i++) {
+            if (_members[i]._member == member) {
+                _members.erase(_members.begin() + i);
+                splitEvenly();
+                return;
+            }
+        }
+    }
+
+    /// @brief Changes the limit, the shares keep their proportions.
+    void configure(size_t maxMemUsage) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t oldMaxMemUsage = _maxMemUsage;
+        _maxMemUsage = maxMemUsage;
+        for (Share &share : _members) {
+            share._maxMemUsage = oldMaxMemUsage > 0 ? scale(share._maxMemUsage, maxMemUsage, oldMaxMemUsage) : 0;
+        }
+        apply();
+    }
+
+    /// @brief Moves the budget toward the caches with the most hits on their last level since the previous call.
+    /// The shares move halfway to their targets on each call, so that a single burst does not empty a cache.
+    void rebalance() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_members.empty()) {
+            return;
+        }
+
+        std::vector<std::uint64_t> hits(_members.size());
+        std::uint64_t totalHits = 0;
+        for (size_t i = 0; i < _members.size(); i++) {
+            std::uint64_t current = _members[i]._member->budgetHits();
+            hits[i] = current - _members[i]._lastHits;
+            _members[i]._lastHits = current;
+            totalHits += hits[i];
+        }
+
+        size_t minShare = scale(_maxMemUsage / _members.size(), _minSharePercent, 100);
+        size_t shared = _maxMemUsage - minShare * _members.size();
+        for (size_t i = 0; i < _members.size(); i++) {
+            size_t target = minShare + (totalHits > 0 ? scale(shared, hits[i], totalHits) : shared / _members.size());
+            size_t current = _members[i]._maxMemUsage;
+            _members[i]._maxMemUsage = current / 2 + target / 2;
+        }
+        apply();
+    }
+
+    size_t getMaxMemUsage() const { return _maxMemUsage; }
+
+    /// @returns the memory limit of the member, 0 if it is not registered.
+    size_t getShare(const Member *member) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const Share &share : _members) {
+            if (share._member == member) {
+                return share._maxMemUsage;
+            }
+        }
+        return 0;
+    }
+
+    /// @brief Memory used by all the registered caches.
+    size_t getTotalMemUsage() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t memUsage = 0;
+        for (const Share &share : _members) {
+            memUsage += share._member->budgetMemUsage();
+        }
+        return memUsage;
+    }
+
+  private:
+    struct Share {
+        Member *_member;
+        std::uint64_t _lastHits;
+        size_t _maxMemUsage;
+    };
+
+    // value * numerator / denominator without overflow.
+    static size_t scale(size_t value, std::uint64_t numerator, std::uint64_t denominator) {
+        return static_cast<size_t>(static_cast<long double>(value) * numerator / denominator);
+    }
+
+    void splitEvenly() {
+        for (Share &share : _members) {
+            share._maxMemUsage = _maxMemUsage / _members.size();
+        }
+        apply();
+    }
+
+    // The caches that shrink first: their memory is freed before the others grow into it.
+    void apply() {
+        for (Share &share : _members) {
+            if (share._member->budgetMemUsage() > share._maxMemUsage) {
+                share._member->setBudgetMemUsage(share._maxMemUsage);
+            }
+        }
+        for (Share &share : _members) {
+            if (share._member->budgetMemUsage() <= share._maxMemUsage) {
+                share._member->setBudgetMemUsage(share._maxMemUsage);
+            }
+        }
+    }
+
+    std::mutex _mutex;
+    size_t _maxMemUsage;
+    unsigned int _minSharePercent;
+    std::vector<Share> _members;
+};
+
+/// @brief Member of a CacheBudget for a Cache or a ShardedCache: uses the hard memory limit of the cache
+/// (configureCapacity) and the hits on its last level. A Cache must only be used by the thread calling the budget.
+/// The hit statistics of the cache must stay enabled (see Cache::configureHitStats): a cache that does not count its
+/// hits only keeps the minimum share once the others show hits, and an even split if none does.
+template <typename TCache> class CacheBudgetMember : public CacheBudget::Member {
+  public:
+    /// @param maxCount limit of the number of values, kept when the budget changes the memory limit.
+    explicit CacheBudgetMember(TCache &cache, size_t maxCount = static_cast<size_t>(-1))
+        : _cache(cache)
+        , _maxCount(maxCount) {}
+
+    size_t budgetMemUsage() const override { return _cache.getTotalMemUsage(); }
+    std::uint64_t budgetHits() const override { return _cache.getStats(TCache::levelCount - 1).hits; }
+    void setBudgetMemUsage(size_t maxMemUsage) override { _cache.configureCapacity(_maxCount, maxMemUsage); }
+
+  private:
+    TCache &_cache;
+    size_t _maxCount;
+};
+
+} // namespace galib
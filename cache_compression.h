@@ -0,0 +1,88 @@
+#pragma once
+
+#include "cache.h"
+#include "cache_snapshot.h"
+#include "lz_codec.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace galib {
+
+/// @brief Store of a Cache level keeping its values compressed in memory (see Cache::configureLevelStore and
+/// lz_codec.h). The values demoted into the level are serialized and compressed, and decompressed when they are
+/// promoted to level 0. The compressed size is added to estimateMemSize, so the memory limits of the level count
+/// compressed bytes. The values that do not shrink are kept as they are.
+/// @example CacheCompressedStore<std::string> compressed;
+/// cache.configureLevel(1, 100000, 256 * 1024 * 1024);
+/// cache.configureLevelStore(1, &compressed);
+template <typename TCacheValue, typename TSerializer = PodCacheSerializer>
+class CacheCompressedStore : public CacheLevelStore<TCacheValue> {
+  public:
+    explicit CacheCompressedStore(TSerializer serializer = TSerializer())
+        : _serializer(std::move(serializer)) {}
+
+    CacheCompressedStore(const CacheCompressedStore &) = delete;
+    CacheCompressedStore &operator=(const CacheCompressedStore &) = delete;
+
+    /// @brief Size of the packed values, before and after compression.
+    std::uint64_t getOriginalSize() const { return _originalSize; }
+    std::uint64_t getCompressedSize() const { return _compressedSize; }
+
+    bool pack(TCacheValue &value, std::uint64_t &location) override {
+        std::string bytes;
+        _serializer.writeValue(value, bytes);
+        std::string *compressed = new std::string();
+        lzCompress(bytes.data(), bytes.size(), *compressed);
+        if (compressed->size() >= bytes.size()) {
+            delete compressed;
+            return false;
+        }
+        compressed->shrink_to_fit();
+        location = reinterpret_cast<std::uintptr_t>(compressed);
+        _originalSize += bytes.size();
+        _compressedSize += compressed->size();
+
+        // Swapped: assigning an empty value could keep the memory of the old one.
+        TCacheValue empty;
+        std::swap(value, empty);
+        return true;
+    }
+
+    bool unpack(std::uint64_t location, TCacheValue &value) const override {
+        const std::string *compressed = buffer(location);
+        std::string bytes;
+        return lzDecompress(compressed->data(), compressed->size(), bytes) &&
+               _serializer.readValue(bytes.data(), bytes.size(), value);
+    }
+
+    void discard(std::uint64_t location) override {
+        std::string *compressed = buffer(location);
+        std::uint64_t originalSize = 0;
+        for (unsigned int i = 0, shift = 0; i < compressed->size(); i++, shift += 7) {
+            originalSize |= static_cast<std::uint64_t>((*compressed)[i] & 0x7f) << shift;
+            if (((*compressed)[i] & 0x80) == 0) {
+                break;
+            }
+        }
+        _originalSize -= originalSize;
+        _compressedSize -= compressed->size();
+        delete compressed;
+    }
+
+    size_t memSize(std::uint64_t location) const override {
+        return sizeof(std::string) + buffer(location)->capacity();
+    }
+
+  private:
+    static std::string *buffer(std::uint64_t location) {
+        return reinterpret_cast<std::string *>(static_cast<std::uintptr_t>(location));
+    }
+
+    mutable TSerializer _serializer;
+    std::uint64_t _originalSize = 0;
+    std::uint64_t _compressedSize = 0;
+};
+
+} // namespace galib
@@ -0,0 +1,446 @@
+#pragma once
+
+#include "intrusive_containers.h"
+
+#include <memory>
+#include <vector>
+
+namespace galib {
+
+// Replacement policies of the Cache levels.
+// A policy has a nested template Level<T>, which orders the values of one level of the cache:
+//  - configure(maxCount): the capacity of the level (see Cache::configureLevel).
+//  - insert(node, atTail): a value enters the level (new, promoted or demoted from the previous level).
+//  - touch(node): a value of the level was accessed.
+//  - requeue(node): a value that cannot leave the level yet (e.g. pinned) moves to the head of its segment, keeping
+//    its segment.
+//  - remove(node, replaced): a value leaves the level. replaced is true if it was chosen with victim(),
+//    i.e. it is demoted to the next level or evicted.
+//  - victim(keep): the next value to leave the level when it is over capacity, never keep. null if there is none.
+//    It may reorder the level (ClockPolicy ages the values it passes).
+//  - peekVictim(): the value victim() would return, without changing the level (see the admission of Cache).
+//  - forEach(fn): calls fn(T *) for all the values, from the next victim to the value kept the longest. Inserting
+//    them in this order in an empty level restores the order (but not the segments).
+// The node type must have a Link<T> _listLink, an unsigned char _segment (free for the policy) and a size_t _hash.
+
+namespace detail {
+
+/// @brief Fifo of the hashes of the values that recently left a level (ARC and 2Q ghost entries).
+/// The nodes are allocated once, up to the capacity, and then recycled.
+class CacheGhostList {
+  public:
+    CacheGhostList() {}
+    CacheGhostList(const CacheGhostList &) = delete;
+    CacheGhostList &operator=(const CacheGhostList &) = delete;
+
+    void configure(size_t capacity) {
+        _capacity = capacity;
+        while (_count > _capacity) {
+            removeNode(_list.tail());
+        }
+    }
+
+    size_t size() const { return _count; }
+
+    void add(size_t hash) {
+        if (_capacity == 0) {
+            return;
+        }
+        Node *node = _dict.get(hash);
+        if (node != nullptr) {
+            // Already a ghost (a key leaving twice, or two keys with the same hash): it becomes the most recent one.
+            node->_listLink.unlink();
+            _list.insertHead(node);
+            return;
+        }
+        if (_count >= _capacity) {
+            node = _list.tail();
+            removeNode(node);
+        } else if (!_free.empty()) {
+            node = _free.back();
+            _free.pop_back();
+        } else {
+            _nodes.emplace_back(new Node());
+            node = _nodes.back().get();
+        }
+        node->_hash = hash;
+        _dict.put(node);
+        _list.insertHead(node);
+        _count++;
+    }
+
+    /// @returns true if the hash was in the list.
+    bool remove(size_t hash) {
+        Node *node = _dict.get(hash);
+        if (node == nullptr) {
+            return false;
+        }
+        removeNode(node);
+        return true;
+    }
+
+  private:
+    struct Node {
+        Link<Node> _dictLink;
+        size_t _hash;
+        Link<Node> _listLink;
+    };
+
+    void removeNode(Node *node) {
+        _dict.remove(node);
+        node->_listLink.unlink();
+        _free.push_back(node);
+        _count--;
+    }
+
+    Dictionary<Node, size_t, &Node::_hash, &Node::_dictLink> _dict;
+    List<Node, &Node::_listLink> _list;
+    std::vector<std::unique_ptr<Node>> _nodes;
+    std::vector<Node *> _free;
+    size_t _count = 0;
+    size_t _capacity = 0;
+};
+
+/// @brief Calls fn for the nodes of the list, from the tail to the head.
+template <typename TList, typename F> void forEachFromTail(const TList &list, F &fn) {
+    for (auto *node = list.tail(); node != nullptr; node = list.prev(node)) {
+        fn(node);
+    }
+}
+
+/// @returns the tail of the list, or the node before it if the tail is keep.
+template <typename TList, typename T> T *tailExcept(const TList &list, const T *keep) {
+    T *node = list.tail();
+    if (node != nullptr && node == keep) {
+        node = list.prev(node);
+    }
+    return node;
+}
+
+} // namespace detail
+
+/// @brief Least recently used: a single list, the accessed values move to the head.
+struct LruPolicy {
+    template <typename T> class Level {
+      public:
+        void configure(unsigned int) {}
+
+        void insert(T *node, bool atTail) {
+            if (atTail) {
+                _list.insertTail(node);
+            } else {
+                _list.insertHead(node);
+            }
+        }
+
+        void touch(T *node) { _list.insertHead(node); }
+        void requeue(T *node) { _list.insertHead(node); }
+        void remove(T *node, bool) { _list.remove(node); }
+        T *victim(const T *keep = nullptr) const { return detail::tailExcept(_list, keep); }
+        T *peekVictim() const { return victim(); }
+        template <typename F> void forEach(F fn) const { detail::forEachFromTail(_list, fn); }
+
+      private:
+        List<T, &T::_listLink> _list;
+    };
+};
+
+/// @brief Segmented LRU: new values enter a probationary segment and move to the protected segment
+/// (at most TProtectedPercent of the level) when they are accessed again. The values leaving the protected segment go
+/// back to the head of the probationary one. The victims are taken from the probationary segment first.
+template <unsigned int TProtectedPercent = 80> struct SlruPolicy {
+    template <typename T> class Level {
+      public:
+        void configure(unsigned int maxCount) {
+            _maxProtected = static_cast<size_t>(maxCount) * TProtectedPercent / 100;
+        }
+
+        void insert(T *node, bool atTail) {
+            node->_segment = probation;
+            if (atTail) {
+                _probation.insertTail(node);
+            } else {
+                _probation.insertHead(node);
+            }
+        }
+
+        void touch(T *node) {
+            if (node->_segment == protect) {
+                _protected.insertHead(node);
+                return;
+            }
+            node->_segment = protect;
+            _protected.insertHead(node);
+            _protectedCount++;
+            while (_protectedCount > _maxProtected) {
+                T *demoted = _protected.tail();
+                demoted->_segment = probation;
+                _probation.insertHead(demoted);
+                _protectedCount--;
+            }
+        }
+
+        void requeue(T *node) { (node->_segment == protect ? _protected : _probation).insertHead(node); }
+
+        void remove(T *node, bool) {
+            if (node->_segment == protect) {
+                _protectedCount--;
+            }
+            node->_listLink.unlink();
+        }
+
+        T *victim(const T *keep = nullptr) const {
+            T *node = detail::tailExcept(_probation, keep);
+            return node != nullptr ? node : detail::tailExcept(_protected, keep);
+        }
+
+        T *peekVictim() const { return victim(); }
+
+        template <typename F> void forEach(F fn) const {
+            detail::forEachFromTail(_probation, fn);
+            detail::forEachFromTail(_protected, fn);
+        }
+
+      private:
+        enum : unsigned char { probation, protect };
+
+        List<T, &T::_listLink> _probation;
+        List<T, &T::_listLink> _protected;
+        size_t _protectedCount = 0;
+        size_t _maxProtected = 0;
+    };
+};
+
+/// @brief 2Q: new values enter a fifo (A1in, TInPercent of the level). The values leaving it are remembered in a ghost
+/// list (A1out, TOutPercent of the level); if they come back they enter the LRU list (Am). A value accessed only once
+/// never displaces the values of Am. Accesses in A1in are ignored.
+template <unsigned int TInPercent = 25, unsigned int TOutPercent = 50> struct TwoQPolicy {
+    template <typename T> class Level {
+      public:
+        void configure(unsigned int maxCount) {
+            _maxIn = static_cast<size_t>(maxCount) * TInPercent / 100;
+            _out.configure(static_cast<size_t>(maxCount) * TOutPercent / 100);
+        }
+
+        void insert(T *node, bool atTail) {
+            bool known = _out.remove(node->_hash);
+            node->_segment = known ? main : in;
+            List<T, &T::_listLink> &list = known ? _main : _in;
+            if (atTail) {
+                list.insertTail(node);
+            } else {
+                list.insertHead(node);
+            }
+            if (!known) {
+                _inCount++;
+            }
+        }
+
+        void touch(T *node) {
+            if (node->_segment == main) {
+                _main.insertHead(node);
+            }
+        }
+
+        void requeue(T *node) { (node->_segment == main ? _main : _in).insertHead(node); }
+
+        void remove(T *node, bool replaced) {
+            if (node->_segment == in) {
+                _inCount--;
+                if (replaced) {
+                    _out.add(node->_hash);
+                }
+            }
+            node->_listLink.unlink();
+        }
+
+        T *victim(const T *keep = nullptr) const {
+            T *node = nullptr;
+            if (_inCount > _maxIn || _main.isEmpty()) {
+                node = detail::tailExcept(_in, keep);
+            }
+            if (node == nullptr) {
+                node = detail::tailExcept(_main, keep);
+            }
+            return node != nullptr ? node : detail::tailExcept(_in, keep);
+        }
+
+        T *peekVictim() const { return victim(); }
+
+        template <typename F> void forEach(F fn) const {
+            detail::forEachFromTail(_in, fn);
+            detail::forEachFromTail(_main, fn);
+        }
+
+      private:
+        enum : unsigned char { in, main };
+
+        List<T, &T::_listLink> _in;
+        List<T, &T::_listLink> _main;
+        detail::CacheGhostList _out;
+        size_t _inCount = 0;
+        size_t _maxIn = 0;
+    };
+};
+
+/// @brief Adaptive replacement cache: T1 holds the values accessed once, T2 the values accessed at least twice.
+/// The ghost lists B1 and B2 remember the values that left T1 and T2. A value coming back from B1 grows the target size
+/// of T1 (recency matters), a value coming back from B2 shrinks it (frequency matters).
+struct ArcPolicy {
+    template <typename T> class Level {
+      public:
+        void configure(unsigned int maxCount) {
+            _capacity = maxCount;
+            _b1.configure(maxCount);
+            _b2.configure(maxCount);
+            if (_target > _capacity) {
+                _target = _capacity;
+            }
+        }
+
+        void insert(T *node, bool atTail) {
+            node->_segment = recent;
+            if (_b1.remove(node->_hash)) {
+                size_t delta = _b1.size() >= _b2.size() ? 1 : _b2.size() / (_b1.size() + 1);
+                _target = (_target + delta < _capacity) ? _target + delta : _capacity;
+                node->_segment = frequent;
+            } else if (_b2.remove(node->_hash)) {
+                size_t delta = _b2.size() >= _b1.size() ? 1 : _b1.size() / (_b2.size() + 1);
+                _target = (_target > delta) ? _target - delta : 0;
+                node->_segment = frequent;
+            }
+
+            List<T, &T::_listLink> &list = (node->_segment == recent) ? _t1 : _t2;
+            if (atTail) {
+                list.insertTail(node);
+            } else {
+                list.insertHead(node);
+            }
+            if (node->_segment == recent) {
+                _t1Count++;
+            }
+        }
+
+        void touch(T *node) {
+            if (node->_segment == recent) {
+                node->_segment = frequent;
+                _t1Count--;
+            }
+            _t2.insertHead(node);
+        }
+
+        void requeue(T *node) { (node->_segment == recent ? _t1 : _t2).insertHead(node); }
+
+        void remove(T *node, bool replaced) {
+            if (node->_segment == recent) {
+                _t1Count--;
+                if (replaced) {
+                    _b1.add(node->_hash);
+                }
+            } else if (replaced) {
+                _b2.add(node->_hash);
+            }
+            node->_listLink.unlink();
+        }
+
+        T *victim(const T *keep = nullptr) const {
+            T *node = nullptr;
+            if (_t1Count > _target || _t2.isEmpty()) {
+                node = detail::tailExcept(_t1, keep);
+            }
+            if (node == nullptr) {
+                node = detail::tailExcept(_t2, keep);
+            }
+            return node != nullptr ? node : detail::tailExcept(_t1, keep);
+        }
+
+        T *peekVictim() const { return victim(); }
+
+        template <typename F> void forEach(F fn) const {
+            detail::forEachFromTail(_t1, fn);
+            detail::forEachFromTail(_t2, fn);
+        }
+
+        /// @brief Target size of T1.
+        size_t target() const { return _target; }
+
+      private:
+        enum : unsigned char { recent, frequent };
+
+        List<T, &T::_listLink> _t1;
+        List<T, &T::_listLink> _t2;
+        detail::CacheGhostList _b1;
+        detail::CacheGhostList _b2;
+        size_t _t1Count = 0;
+        size_t _target = 0;
+        size_t _capacity = 0;
+    };
+};
+
+/// @brief CLOCK (second chance): a hit only sets the reference bit of the value, the list is not relinked, so the
+/// values that are already hot are not written to again. The list is the clock and its tail the hand: victim() clears
+/// the referenced values at the hand and moves them to the head until it finds one that was not referenced.
+/// peekVictim() finds the same value without moving the hand. To keep the hits free of writes, disable the hit
+/// counters of the cache (see Cache::configureHitStats).
+struct ClockPolicy {
+    template <typename T> class Level {
+      public:
+        void configure(unsigned int) {}
+
+        void insert(T *node, bool atTail) {
+            node->_segment = unreferenced;
+            if (atTail) {
+                _list.insertTail(node);
+            } else {
+                _list.insertHead(node);
+            }
+            _count++;
+        }
+
+        void touch(T *node) {
+            if (node->_segment != referenced) {
+                node->_segment = referenced;
+            }
+        }
+
+        void requeue(T *node) { _list.insertHead(node); }
+
+        void remove(T *node, bool) {
+            _list.remove(node);
+            _count--;
+        }
+
+        T *victim(const T *keep = nullptr) {
+            // Every value is seen at most twice: once to clear its bit, then as a victim (keep is never one).
+            for (size_t i = 0; i <= 2 * _count; i++) {
+                T *node = _list.tail();
+                if (node == nullptr || (node->_segment != referenced && node != keep)) {
+                    return node;
+                }
+                node->_segment = unreferenced;
+                _list.insertHead(node);
+            }
+            return nullptr;
+        }
+
+        T *peekVictim() const {
+            // The first value the hand would find unreferenced, or the hand itself after a full turn.
+            for (T *node = _list.tail(); node != nullptr; node = _list.prev(node)) {
+                if (node->_segment != referenced) {
+                    return node;
+                }
+            }
+            return _list.tail();
+        }
+
+        template <typename F> void forEach(F fn) const { detail::forEachFromTail(_list, fn); }
+
+      private:
+        enum : unsigned char { unreferenced, referenced };
+
+        List<T, &T::_listLink> _list;
+        size_t _count = 0;
+    };
+};
+
+} // namespace galib
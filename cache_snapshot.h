@@ -0,0 +1,71 @@
+#pragma once
+
+#include "file_system.h"
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace galib {
+
+/// @brief Serializer of the Cache snapshots for std::string and trivially copyable keys and values (copied as bytes,
+/// so the snapshot can only be loaded on the same platform).
+struct PodCacheSerializer {
+    void writeKey(const std::string &key, std::string &out) { out.append(key); }
+    bool readKey(const char *data, size_t size, std::string &key) {
+        key.assign(data, size);
+        return true;
+    }
+    template <typename T> void writeKey(const T &key, std::string &out) { writeBytes(key, out); }
+    template <typename T> bool readKey(const char *data, size_t size, T &key) { return readBytes(data, size, key); }
+
+    void writeValue(const std::string &value, std::string &out) { out.append(value); }
+    bool readValue(const char *data, size_t size, std::string &value) {
+        value.assign(data, size);
+        return true;
+    }
+    template <typename T> void writeValue(const T &value, std::string &out) { writeBytes(value, out); }
+    template <typename T> bool readValue(const char *data, size_t size, T &value) {
+        return readBytes(data, size, value);
+    }
+
+  private:
+    template <typename T> static void writeBytes(const T &value, std::string &out) {
+        static_assert(std::is_trivially_copyable<T>::value, "write a serializer for this type");
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T> static bool readBytes(const char *data, size_t size, T &value) {
+        static_assert(std::is_trivially_copyable<T>::value, "write a serializer for this type");
+        if (size != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        return true;
+    }
+};
+
+/// @brief Writes a snapshot of the cache (see Cache::serialize) to a file, atomically (see writeFile).
+/// @example saveSnapshot(cache, "/var/cache/files.snapshot");
+/// ... after the restart:
+/// loadSnapshot(cache, "/var/cache/files.snapshot");
+template <typename TCache, typename TSerializer = PodCacheSerializer>
+bool saveSnapshot(const TCache &cache, const std::string &path, TSerializer serializer = TSerializer()) {
+    std::string bytes;
+    cache.serialize(bytes, serializer);
+    return writeFile(path, bytes);
+}
+
+/// @brief Replaces the values of the cache with the ones of a snapshot file. The file is read with a single read and
+/// the cache is rebuilt in bulk (see Cache::deserialize).
+/// @returns false if the file cannot be read or is not a valid snapshot, in that case the cache is not changed.
+template <typename TCache, typename TSerializer = PodCacheSerializer>
+bool loadSnapshot(TCache &cache, const std::string &path, TSerializer serializer = TSerializer()) {
+    std::string bytes;
+    if (!readFile(path, bytes)) {
+        return false;
+    }
+    return cache.deserialize(bytes.data(), bytes.size(), serializer);
+}
+
+} // namespace galib
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "cache.h"
+#include "cache_snapshot.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace galib {
+
+/// @brief Store of a Cache level in an append-only file (see Cache::configureLevelStore): the values demoted into the
+/// level are serialized at the end of the file and only their location stays in memory, 8 bytes in the node (offset
+/// and size). The space of the values leaving the level is reclaimed by rewriting the file once it is more than half
+/// of it. The file is a scratch file: it is truncated when opened and can only be read by this store.
+/// @example CacheSpillFile<std::string> spill("/var/tmp/files.spill");
+/// cache.configureLevel(2, 1000000, 64ULL * 1024 * 1024 * 1024);
+/// cache.configureLevelStore(2, &spill);
+template <typename TCacheValue, typename TSerializer = PodCacheSerializer>
+class CacheSpillFile : public CacheLevelStore<TCacheValue> {
+  public:
+    /// @brief Largest serialized value, the bigger values stay in memory.
+    static const std::uint64_t maxValueSize = (std::uint64_t(1) << 24) - 1;
+    /// @brief Largest file (1 TB): the values are kept in memory once it is reached.
+    static const std::uint64_t maxFileSize = std::uint64_t(1) << 40;
+
+  public:
+    /// @param minCompactionSize the file is only rewritten once the discarded values use at least this size.
+    explicit CacheSpillFile(const std::string &path, std::uint64_t minCompactionSize = 1024 * 1024,
+                            TSerializer serializer = TSerializer())
+        : _path(path)
+        , _serializer(std::move(serializer))
+        , _minCompactionSize(minCompactionSize) {
+        _file = std::fopen(_path.c_str(), "w+b");
+    }
+
+    ~CacheSpillFile() {
+        if (_file != nullptr) {
+            std::fclose(_file);
+            std::remove(_path.c_str());
+        }
+    }
+
+    CacheSpillFile(const CacheSpillFile &) = delete;
+    CacheSpillFile &operator=(const CacheSpillFile &) = delete;
+
+    bool isOpen() const { return _file != nullptr; }
+
+    /// @brief Size of the file, including the values that were discarded since the last compaction.
+    std::uint64_t getFileSize() const { return _fileSize; }
+
+    /// @brief Size of the values in use.
+    std::uint64_t getLiveSize() const { return _liveSize; }
+
+    bool pack(TCacheValue &value, std::uint64_t &location) override {
+        std::string bytes;
+        _serializer.writeValue(value, bytes);
+        if (_file == nullptr || bytes.size() > maxValueSize || _fileSize + bytes.size() > maxFileSize ||
+            !writeAt(_file, _fileSize, bytes)) {
+            return false;
+        }
+        location = (_fileSize << sizeBits) | bytes.size();
+        _fileSize += bytes.size();
+        _liveSize += bytes.size();
+
+        // Swapped: assigning an empty value could keep the memory of the old one.
+        TCacheValue empty;
+        std::swap(value, empty);
+        return true;
+    }
+
+    bool unpack(std::uint64_t location, TCacheValue &value) const override {
+        std::string bytes;
+        return readAt(_file, location, bytes) && _serializer.readValue(bytes.data(), bytes.size(), value);
+    }
+
+    void discard(std::uint64_t location) override { _liveSize -= location & maxValueSize; }
+
+    bool needsCompaction() const override {
+        std::uint64_t garbage = _fileSize - _liveSize;
+        return garbage >= _minCompactionSize && garbage > _liveSize;
+    }
+
+    /// @brief Copies the values to a new file, in the order of the locations, and replaces the file with it.
+    /// If the new file cannot be written, the current one is kept. Both files are closed before the replacement
+    /// (Windows cannot rename an open file): if the file cannot be reopened, the packed values are lost.
+    void compact(std::uint64_t *const *locations, size_t count) override {
+        std::string compactPath = _path + ".compact";
+        std::FILE *file = std::fopen(compactPath.c_str(), "w+b");
+        if (file == nullptr) {
+            return;
+        }
+
+        std::vector<std::uint64_t> moved(count);
+        std::uint64_t fileSize = 0;
+        std::string bytes;
+        bool valid = true;
+        for (size_t i = 0; i < count && valid; i++) {
+            valid = readAt(_file, *locations[i], bytes) && writeAt(file, fileSize, bytes);
+            moved[i] = (fileSize << sizeBits) | bytes.size();
+            fileSize += bytes.size();
+        }
+        if (!valid || std::fflush(file) != 0) {
+            std::fclose(file);
+            std::remove(compactPath.c_str());
+            return;
+        }
+
+        std::fclose(file);
+        std::fclose(_file);
+        if (!replaceFile(compactPath, _path)) {
+            std::remove(compactPath.c_str());
+            _file = std::fopen(_path.c_str(), "r+b");
+            return;
+        }
+        _file = std::fopen(_path.c_str(), "r+b");
+        _fileSize = fileSize;
+        _liveSize = fileSize;
+        for (size_t i = 0; i < count; i++) {
+            *locations[i] = moved[i];
+        }
+    }
+
+  private:
+    static const unsigned int sizeBits = 24;
+
+    static bool seek(std::FILE *file, std::uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(file, static_cast<long long>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    static bool replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows. The file is a scratch file: it can be removed first.
+        std::remove(to.c_str());
+#endif
+        return std::rename(from.c_str(), to.c_str()) == 0;
+    }
+
+    static bool writeAt(std::FILE *file, std::uint64_t offset, const std::string &bytes) {
+        return seek(file, offset) && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+    static bool readAt(std::FILE *file, std::uint64_t location, std::string &bytes) {
+        bytes.resize(static_cast<size_t>(location & maxValueSize));
+        return file != nullptr && seek(file, location >> sizeBits) &&
+               std::fread(&bytes[0], 1, bytes.size(), file) == bytes.size();
+    }
+
+    std::string _path;
+    std::FILE *_file = nullptr;
+    mutable TSerializer _serializer;
+    std::uint64_t _minCompactionSize;
+    std::uint64_t _fileSize = 0;
+    std::uint64_t _liveSize = 0;
+};
+
+} // namespace galib
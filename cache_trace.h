@@ -0,0 +1,191 @@
+#pragma once
+
+#include "cache.h"
+#include "file_system.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace galib {
+
+/// @brief Compact binary trace of the operations of caches (see Cache::configureTrace), to replay them offline with
+/// other configurations (see replayTrace and tools/cache_replay.cpp). A record is the operation (1 byte), the hash of
+/// the key (8 bytes) and the memory size of the value (varint): about 11 bytes per operation.
+/// Thread-safe: it can be shared by the shards of a ShardedCache.
+/// @example CacheTrace trace;
+/// cache.configureTrace(&trace);
+/// ... later:
+/// cache.configureTrace(nullptr);
+/// trace.save("/tmp/files.trace");
+class CacheTrace : public CacheTraceSink {
+  public:
+    struct Record {
+        CacheTraceOp op;
+        std::uint64_t hash;
+        std::uint64_t memSize;
+    };
+
+  public:
+    CacheTrace() {}
+    CacheTrace(const CacheTrace &) = delete;
+    CacheTrace &operator=(const CacheTrace &) = delete;
+
+    void record(CacheTraceOp op, size_t hash, size_t memSize) override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bytes.push_back(static_cast<char>(op));
+        std::uint64_t bits = hash;
+        for (int i = 0; i < 8; i++) {
+            _bytes.push_back(static_cast<char>(bits & 0xff));
+            bits >>= 8;
+        }
+        detail::appendVarint(_bytes, memSize);
+        _count++;
+    }
+
+    /// @brief Number of records.
+    size_t size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _count;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bytes.clear();
+        _count = 0;
+    }
+
+    bool save(const std::string &path) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return writeFile(path, std::string(magic(), magicSize) + _bytes);
+    }
+
+    /// @brief Replaces the records with the ones of a trace file.
+    /// @returns false if the file cannot be read or is not a valid trace, in that case the trace is not changed.
+    bool load(const std::string &path) {
+        std::string bytes;
+        if (!readFile(path, bytes) || bytes.compare(0, magicSize, magic(), magicSize) != 0) {
+            return false;
+        }
+        bytes.erase(0, magicSize);
+        size_t count = 0;
+        if (!parse(bytes, [&](const Record &) { count++; })) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bytes.swap(bytes);
+        _count = count;
+        return true;
+    }
+
+    /// @brief Calls fn(const Record &) for every record, in the order they were recorded. Must not be called while
+    /// the trace is recording.
+    template <typename F> void forEach(F fn) const { parse(_bytes, fn); }
+
+  private:
+    static const size_t magicSize = 4;
+    static const char *magic() { return "GCT1"; }
+
+    template <typename F> static bool parse(const std::string &bytes, F fn) {
+        const char *pos = bytes.data();
+        const char *end = pos + bytes.size();
+        while (pos < end) {
+            Record record;
+            if (static_cast<unsigned char>(*pos) > static_cast<unsigned char>(CacheTraceOp::remove) || end - pos < 9) {
+                return false;
+            }
+            record.op = static_cast<CacheTraceOp>(*pos++);
+            record.hash = 0;
+            for (int i = 0; i < 8; i++) {
+                record.hash |= static_cast<std::uint64_t>(static_cast<unsigned char>(*pos++)) << (8 * i);
+            }
+            if (!detail::readVarint(pos, end, record.memSize)) {
+                return false;
+            }
+            fn(record);
+        }
+        return true;
+    }
+
+    std::mutex _mutex;
+    std::string _bytes;
+    size_t _count = 0;
+};
+
+/// @brief Cache simulating another one from its trace: the keys are the hashes of the keys, and the values their
+/// recorded memory size, used as estimateMemSize.
+template <unsigned int TMaxLevel, typename TPolicy = LruPolicy>
+class ReplayCache : public Cache<std::uint64_t, std::uint64_t, TMaxLevel, InlineCacheValue, TPolicy> {
+  public:
+    typedef typename Cache<std::uint64_t, std::uint64_t, TMaxLevel, InlineCacheValue, TPolicy>::KeyValue KeyValue;
+
+    /// @brief Memory size of the value created by the next miss. 0: the key does not exist.
+    void setNextMemSize(std::uint64_t memSize) { _nextMemSize = memSize; }
+
+  protected:
+    KeyValue *newCacheValue(const std::uint64_t &, int) override {
+        if (_nextMemSize == 0) {
+            return nullptr;
+        }
+        KeyValue *kv = new KeyValue();
+        kv->data = _nextMemSize;
+        return kv;
+    }
+
+    size_t estimateMemSize(KeyValue *kv) override { return static_cast<size_t>(kv->data); }
+
+  private:
+    std::uint64_t _nextMemSize = 0;
+};
+
+/// @brief Result of replayTrace.
+struct CacheReplayResult {
+    /// @brief Statistics of every level of the simulated cache.
+    std::vector<CacheLevelStats> levels;
+    std::uint64_t operations = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    size_t peakMemUsage = 0;
+    double seconds = 0;
+
+    double hitRatio() const { return (hits + misses) > 0 ? static_cast<double>(hits) / (hits + misses) : 0; }
+    double operationsPerSecond() const { return seconds > 0 ? operations / seconds : 0; }
+};
+
+/// @brief Replays the trace on a ReplayCache configured by the caller (levels, capacity, admission...).
+template <typename TReplayCache> CacheReplayResult replayTrace(const CacheTrace &trace, TReplayCache &cache) {
+    CacheReplayResult result;
+    auto start = std::chrono::steady_clock::now();
+    trace.forEach([&](const CacheTrace::Record &record) {
+        switch (record.op) {
+        case CacheTraceOp::get:
+            cache.setNextMemSize(record.memSize);
+            cache.get(record.hash);
+            break;
+        case CacheTraceOp::touch:
+            cache.touch(record.hash);
+            break;
+        case CacheTraceOp::put:
+            cache.put(record.hash, record.memSize);
+            break;
+        case CacheTraceOp::remove:
+            cache.remove(record.hash);
+            break;
+        }
+        result.operations++;
+        size_t memUsage = cache.getTotalMemUsage();
+        result.peakMemUsage = (memUsage > result.peakMemUsage) ? memUsage : result.peakMemUsage;
+    });
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (unsigned int i = 0; i < TReplayCache::levelCount; i++) {
+        result.levels.push_back(cache.getStats(i));
+        result.hits += result.levels.back().hits;
+        result.misses += result.levels.back().misses;
+    }
+    return result;
+}
+
+} // namespace galib
@@ -5,7 +5,11 @@
 #define _u_needed_to_undefine_assert
 #endif
 
+#include <cstdint>
+#include <functional>
 #include <iterator>
+#include <tuple>
+#include <vector>
 
 namespace galib {
 
@@ -24,6 +28,9 @@ template <typename T> class Link {
     void insertAfter(T *node, std::size_t offset);
     void insertBefore(T *node, std::size_t offset);
 
+    /// @brief Moves the links [first, last] (in list order) before this link. This link must not be in the range.
+    void spliceBefore(Link<T> *first, Link<T> *last);
+
     Link<T> *prevLink() const;
     Link<T> *nextLink() const;
 
@@ -104,6 +111,17 @@ template <typename T> void Link<T>::insertBefore(T *node, std::size_t offset) {
     insertBefore(getLink(node, offset));
 }
 
+template <typename T> void Link<T>::spliceBefore(Link<T> *first, Link<T> *last) {
+    assert(first != nullptr && last != nullptr);
+    first->m_prev->m_next = last->m_next;
+    last->m_next->m_prev = first->m_prev;
+
+    first->m_prev = m_prev;
+    last->m_next = this;
+    m_prev->m_next = first;
+    m_prev = last;
+}
+
 template <typename T> Link<T> *Link<T>::nextLink() const { return m_next; }
 
 template <typename T> Link<T> *Link<T>::prevLink() const { return m_prev; }
@@ -350,6 +368,20 @@ template <typename T, Link<T> T::*TLinkField> class List {
     void insertTail(T *node);
     void insertBefore(T *node, T *before);
     void insertAfter(T *node, T *after);
+    void remove(T *node);
+
+    /// @brief Moves all the nodes of other before the node (or at the tail if before is null). O(1).
+    void splice(T *before, List &other);
+
+    /// @brief Moves the node and all the nodes after it to the tail of out. O(1).
+    void splitAt(T *node, List &out);
+
+    /// @brief Stable bottom-up merge sort of the nodes, O(n log n) and without allocations.
+    /// @param cmp returns true if the first node must be placed before the second one: bool(const T &, const T &).
+    template <typename Compare> void sort(Compare cmp);
+
+    /// @brief Merges the nodes of other into this list. Both lists must be sorted with cmp. Stable.
+    template <typename Compare> void merge(List &other, Compare cmp);
 
     T *head() const;
     T *tail() const;
@@ -444,6 +476,97 @@ template <typename T, Link<T> T::*TLinkField> void List<T, TLinkField>::insertAf
     }
 }
 
+template <typename T, Link<T> T::*TLinkField> void List<T, TLinkField>::remove(T *node) {
+    assert(node != nullptr);
+    Link<T>::getLink(node, m_offset)->unlink();
+}
+
+template <typename T, Link<T> T::*TLinkField> void List<T, TLinkField>::splice(T *before, List &other) {
+    if (&other == this || other.isEmpty()) {
+        return;
+    }
+
+    Link<T> *link = (nullptr == before) ? &m_link : Link<T>::getLink(before, m_offset);
+    link->spliceBefore(other.m_link.nextLink(), other.m_link.prevLink());
+}
+
+template <typename T, Link<T> T::*TLinkField> void List<T, TLinkField>::splitAt(T *node, List &out) {
+    if (nullptr == node || &out == this) {
+        return;
+    }
+
+    out.m_link.spliceBefore(Link<T>::getLink(node, m_offset), m_link.prevLink());
+}
+
+template <typename T, Link<T> T::*TLinkField>
+template <typename Compare>
+void List<T, TLinkField>::sort(Compare cmp) {
+    // Merge the runs of width 1, 2, 4 ... in place until a single run is left.
+    for (size_t width = 1;; width <<= 1) {
+        size_t merges = 0;
+        Link<T> *run = m_link.nextLink();
+        while (run != &m_link) {
+            merges++;
+
+            // The first run starts at run, the second one after width nodes.
+            Link<T> *a = run;
+            Link<T> *b = run;
+            size_t na = 0;
+            while (na < width && b != &m_link) {
+                b = b->nextLink();
+                na++;
+            }
+
+            size_t nb = width;
+            while (na > 0 && nb > 0 && b != &m_link) {
+                if (cmp(*Link<T>::getData(b, m_offset), *Link<T>::getData(a, m_offset))) {
+                    // Only move a node of the second run if it is strictly smaller, which keeps the sort stable.
+                    Link<T> *next = b->nextLink();
+                    a->insertBefore(b);
+                    b = next;
+                    nb--;
+                } else {
+                    a = a->nextLink();
+                    na--;
+                }
+            }
+
+            while (nb > 0 && b != &m_link) {
+                b = b->nextLink();
+                nb--;
+            }
+            run = b;
+        }
+
+        if (merges <= 1) {
+            break;
+        }
+    }
+}
+
+template <typename T, Link<T> T::*TLinkField>
+template <typename Compare>
+void List<T, TLinkField>::merge(List &other, Compare cmp) {
+    if (&other == this) {
+        return;
+    }
+
+    Link<T> *a = m_link.nextLink();
+    Link<T> *b = other.m_link.nextLink();
+    while (a != &m_link && b != &other.m_link) {
+        if (cmp(*Link<T>::getData(b, m_offset), *Link<T>::getData(a, m_offset))) {
+            Link<T> *next = b->nextLink();
+            a->insertBefore(b);
+            b = next;
+        } else {
+            a = a->nextLink();
+        }
+    }
+
+    // The remaining nodes of other are all after the nodes of this list.
+    splice(nullptr, other);
+}
+
 template <typename T, Link<T> T::*TLinkField> T *List<T, TLinkField>::head() const {
     Link<T> *next = m_link.nextLink();
     if (next == &m_link) {
@@ -501,46 +624,83 @@ template <typename T, Link<T> T::*TLinkField> typename List<T, TLinkField>::iter
 
 template <typename T, Link<T> T::*TLinkField>
 typename List<T, TLinkField>::const_iterator List<T, TLinkField>::begin() const {
-    return const_iterator(&m_link, m_offset, head());
+    return const_iterator(const_cast<Link<T> *>(&m_link), m_offset, head());
 }
 
 template <typename T, Link<T> T::*TLinkField>
 typename List<T, TLinkField>::const_iterator List<T, TLinkField>::end() const {
-    return const_iterator(&m_link, m_offset, nullptr);
+    return const_iterator(const_cast<Link<T> *>(&m_link), m_offset, nullptr);
 }
 
 template <typename T, Link<T> T::*TLinkField> void List<T, TLinkField>::clear() { unlinkAll(); }
 
-/// @brief Intrusive HashSet.
+/// @brief Intrusive HashSet. The values are hashed and compared by their content (Hash and Pred receive a const T &).
 /// @example Item will be contained in (up to) two hashsets:
 /// struct Item {
+///   std::string name;
 ///   Link<Item> _all;
 ///   Link<Item> _used;
 ///   ...
 /// };
-/// HashSet<Item, &Item::_all> allItems;
-/// HashSet<Item, &Item::_used> usedItems;
-template <typename T, Link<T> T::*TLinkField, typename Hash = std::hash<T *>, typename Pred = std::equal_to<T *>>
+/// struct ItemHash { size_t operator()(const Item &item) const { return std::hash<std::string>()(item.name); } };
+/// struct ItemEqual { bool operator()(const Item &a, const Item &b) const { return a.name == b.name; } };
+/// HashSet<Item, &Item::_all, ItemHash, ItemEqual> allItems;
+/// HashSet<Item, &Item::_used, ItemHash, ItemEqual> usedItems;
+/// @note The set grows automatically when it holds more values than buckets.
+template <typename T, Link<T> T::*TLinkField, typename Hash = std::hash<T>, typename Pred = std::equal_to<T>>
 class HashSet {
   public:
+    HashSet();
     HashSet(size_t n);
     virtual ~HashSet();
 
-    bool contains(T *value) const;
+    /// @brief Changes the number of buckets, keeping the values that are already in the set.
+    void rehash(size_t n);
+
+    bool contains(const T *value) const;
+
+    /// @brief Returns the value of the set that is equal to value (or null). Used to intern values.
+    T *find(const T *value) const;
+
+    /// @returns false if an equal value is already in the set.
     bool put(T *value);
+    void remove(T *value);
 
+    size_t countCollisions() const;
+    size_t bucketCount() const;
     bool isEmpty() const;
     void unlinkAll();
     void deleteAll();
 
+  public:
+    // std iterators
+    typedef detail::DictionaryIterator<T, T *, T &> iterator;
+    typedef detail::DictionaryIterator<T, const T *, const T &> const_iterator;
+    typedef ptrdiff_t difference_type;
+    typedef size_t size_type;
+    typedef T value_type;
+    typedef T *pointer;
+    typedef T &reference;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    void clear();
+
   protected:
     Link<T> *m_buckets;
-    size_t m_size;
+    size_t m_size; // MUST always be a power of 2. A minimum of 16 is enforced.
     size_t m_offset;
 
-    Link<T> *getBucket(T *val) const;
+    // Upper bound of the number of values (see Dictionary::m_count).
+    size_t m_count;
 
-    HashSet();
+    size_t calculateCapacity(size_t initialCapacity);
+    void grow();
+    size_t countValues() const;
+    Link<T> *getBucket(const T *val) const;
 
     // Hide copy-constructor and assignment operator
     HashSet(const HashSet &) {}
@@ -551,11 +711,20 @@ class HashSet {
 // ---- HashSet ----
 // -----------------
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
-HashSet<T, TLinkField, Hash, Pred>::HashSet(size_t n) {
-    assert(n > 0);
+HashSet<T, TLinkField, Hash, Pred>::HashSet() {
+    m_size = calculateCapacity(0);
+    m_buckets = new Link<T>[m_size];
+    m_count = 0;
 
-    m_buckets = new Link<T>[n];
-    m_size = n;
+    auto m = TLinkField;
+    m_offset = *reinterpret_cast<size_t *>(&m);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+HashSet<T, TLinkField, Hash, Pred>::HashSet(size_t n) {
+    m_size = calculateCapacity(n);
+    m_buckets = new Link<T>[m_size];
+    m_count = 0;
 
     auto m = TLinkField;
     m_offset = *reinterpret_cast<size_t *>(&m);
@@ -571,17 +740,97 @@ HashSet<T, TLinkField, Hash, Pred>::~HashSet() {
 }
 
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
-Link<T> *HashSet<T, TLinkField, Hash, Pred>::getBucket(T *val) const {
+void HashSet<T, TLinkField, Hash, Pred>::rehash(size_t n) {
+    n = calculateCapacity(n);
+    if (n == m_size) {
+        return;
+    }
+
+    Link<T> *buckets = new Link<T>[n];
+    for (size_t i = 0; i < m_size; i++) {
+        Link<T> *link = &(m_buckets[i]);
+        Link<T> *next = link->nextLink();
+        while (link != next) {
+            Link<T> *tmp = next;
+            next = next->nextLink();
+
+            T *v = Link<T>::getData(tmp, m_offset);
+            buckets[Hash()(*v) & (n - 1)].insertBefore(tmp);
+        }
+    }
+
+    delete[] m_buckets;
+    m_buckets = buckets;
+    m_size = n;
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+size_t HashSet<T, TLinkField, Hash, Pred>::calculateCapacity(size_t initialCapacity) {
+    size_t capacity = 16;
+    while (capacity < initialCapacity) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+void HashSet<T, TLinkField, Hash, Pred>::grow() {
+    m_count = countValues();
+    if (m_count > m_size / 2) {
+        rehash(2 * m_count);
+    }
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+size_t HashSet<T, TLinkField, Hash, Pred>::countValues() const {
+    size_t n = 0;
+    for (size_t i = 0; i < m_size; i++) {
+        Link<T> *link = &(m_buckets[i]);
+        for (Link<T> *next = link->nextLink(); next != link; next = next->nextLink()) {
+            n++;
+        }
+    }
+    return n;
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+Link<T> *HashSet<T, TLinkField, Hash, Pred>::getBucket(const T *val) const {
     if (nullptr == val) {
         return nullptr;
     }
 
-    size_t h = Hash()(val);
-    return &(m_buckets[h % m_size]);
+    size_t h = Hash()(*val);
+    return &(m_buckets[h & (m_size - 1)]);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+size_t HashSet<T, TLinkField, Hash, Pred>::countCollisions() const {
+    size_t n = 0;
+    for (size_t i = 0; i < m_size; i++) {
+        Link<T> *link = &(m_buckets[i]);
+        Link<T> *next = link->nextLink();
+        if (link != next) {
+            next = next->nextLink();
+            while (link != next) {
+                n++;
+                next = next->nextLink();
+            }
+        }
+    }
+    return n;
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+size_t HashSet<T, TLinkField, Hash, Pred>::bucketCount() const {
+    return m_size;
 }
 
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
 bool HashSet<T, TLinkField, Hash, Pred>::isEmpty() const {
+    if (m_count == 0) {
+        return true;
+    }
+
     for (size_t i = 0; i < m_size; i++) {
         if (m_buckets[i].next(m_offset) != nullptr) {
             return false;
@@ -601,6 +850,7 @@ void HashSet<T, TLinkField, Hash, Pred>::unlinkAll() {
             tmp->unlink();
         }
     }
+    m_count = 0;
 }
 
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
@@ -614,21 +864,28 @@ void HashSet<T, TLinkField, Hash, Pred>::deleteAll() {
             delete tmp->owner(m_offset);
         }
     }
+    m_count = 0;
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+bool HashSet<T, TLinkField, Hash, Pred>::contains(const T *value) const {
+    return find(value) != nullptr;
 }
 
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
-bool HashSet<T, TLinkField, Hash, Pred>::contains(T *value) const {
+T *HashSet<T, TLinkField, Hash, Pred>::find(const T *value) const {
     Link<T> *link = getBucket(value);
     if (nullptr != link) {
         Link<T> *next = link->nextLink();
         while (next != link) {
             T *v = Link<T>::getData(next, m_offset);
-            if (Pred()(value, v)) {
-                return true;
+            if (Pred()(*value, *v)) {
+                return v;
             }
+            next = next->nextLink();
         }
     }
-    return false;
+    return nullptr;
 }
 
 template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
@@ -641,14 +898,59 @@ bool HashSet<T, TLinkField, Hash, Pred>::put(T *value) {
     Link<T> *next = link->nextLink();
     while (next != link) {
         T *v = Link<T>::getData(next, m_offset);
-        if (Pred()(value, v)) {
+        if (Pred()(*value, *v)) {
             return false;
         }
+        next = next->nextLink();
     }
     link->insertBefore(value, m_offset);
+
+    if (++m_count > m_size) {
+        grow();
+    }
     return true;
 }
 
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+void HashSet<T, TLinkField, Hash, Pred>::remove(T *value) {
+    assert(value != nullptr);
+    Link<T> *link = Link<T>::getLink(value, m_offset);
+    if (link->isLinked()) {
+        link->unlink();
+        if (m_count > 0) {
+            m_count--;
+        }
+    }
+}
+
+// -------------------------------------------
+// ---- HashSet iterators and std methods ----
+// -------------------------------------------
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+typename HashSet<T, TLinkField, Hash, Pred>::iterator HashSet<T, TLinkField, Hash, Pred>::begin() {
+    return iterator(m_buckets, m_buckets + m_size, m_offset, 0);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+typename HashSet<T, TLinkField, Hash, Pred>::iterator HashSet<T, TLinkField, Hash, Pred>::end() {
+    return iterator(m_buckets, m_buckets + m_size, m_offset, m_size);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+typename HashSet<T, TLinkField, Hash, Pred>::const_iterator HashSet<T, TLinkField, Hash, Pred>::begin() const {
+    return const_iterator(m_buckets, m_buckets + m_size, m_offset, 0);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+typename HashSet<T, TLinkField, Hash, Pred>::const_iterator HashSet<T, TLinkField, Hash, Pred>::end() const {
+    return const_iterator(m_buckets, m_buckets + m_size, m_offset, m_size);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+void HashSet<T, TLinkField, Hash, Pred>::clear() {
+    unlinkAll();
+}
+
 /// @brief Intrusive Dictionary.
 /// @example Item can be searched by key in the dictionary:
 /// struct Item {
@@ -657,8 +959,11 @@ bool HashSet<T, TLinkField, Hash, Pred>::put(T *value) {
 ///   ...
 /// };
 /// Dictionary<Item, int, &Item::key, &Item::_link> dict;
+/// @note Up to TSmallCapacity values are kept in a single inline bucket (no allocation and no hashing,
+/// the values are found with a linear scan). Past that the dictionary switches to an allocated bucket array.
+/// The dictionary grows automatically when it holds more values than buckets.
 template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash = std::hash<K>,
-          typename Pred = std::equal_to<K>>
+          typename Pred = std::equal_to<K>, size_t TSmallCapacity = 8>
 class Dictionary {
   public:
     Dictionary();
@@ -667,10 +972,32 @@ class Dictionary {
 
     bool resize(size_t n);
 
+    /// @brief Changes the number of buckets, keeping the values that are already in the dictionary.
+    void rehash(size_t n);
+
+    typedef Hash hasher;
+
     T *get(const K &value) const;
     bool put(T *value);
+    void remove(T *value);
+
+    /// @brief Same as get/put, for callers that already computed hasher()(key) (e.g. cached in the value).
+    T *get(const K &value, size_t hash) const;
+    bool put(T *value, size_t hash);
+
+    /// @brief Hints the CPU to load the bucket of the hash, so that a batch of gets can overlap their cache misses:
+    /// prefetch the buckets of all the keys first, then get them.
+    void prefetch(size_t hash) const;
+
+    /// @brief Puts all the values (pointers to T) of the range [first, last).
+    /// The buckets are sized for the final number of values once and the values are linked bucket by bucket.
+    /// @param uniqueKeys the caller guarantees that no key is duplicated (in the range or in the dictionary),
+    ///                   which skips the duplicate scan done by put().
+    /// @returns the number of values that were put.
+    template <typename TIterator> size_t bulkLoad(TIterator first, TIterator last, bool uniqueKeys = false);
 
     size_t countCollisions() const;
+    size_t bucketCount() const;
     bool isEmpty() const;
     void unlinkAll();
     void deleteAll();
@@ -694,11 +1021,23 @@ class Dictionary {
 
   protected:
     Link<T> *m_buckets;
-    size_t m_size; // MUST always be a power of 2. A minimum of 16 is enforced.
+    size_t m_size; // MUST always be a power of 2. A minimum of 16 is enforced (or 1 for the inline bucket).
     size_t m_offset;
 
+    // Upper bound of the number of values: a value can unlink itself (e.g. when deleted) without the dictionary
+    // knowing about it. The exact number is recounted before growing.
+    size_t m_count;
+    Link<T> m_smallBucket;
+
     size_t calculateCapacity(size_t initialCapacity);
+    void allocateBuckets(size_t n);
+    void freeBuckets();
+    void grow();
+    size_t countValues() const;
     Link<T> *getBucket(const K &key) const;
+    Link<T> *getBucketByHash(size_t hash) const;
+    T *findInBucket(Link<T> *bucket, const K &key) const;
+    bool insertInBucket(Link<T> *bucket, T *value);
 
     // Hide copy-constructor and assignment operator
     Dictionary(const Dictionary &) {}
@@ -708,52 +1047,86 @@ class Dictionary {
 // --------------------
 // ---- Dictionary ----
 // --------------------
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::Dictionary() {
-    m_buckets = new Link<T>[32];
-    m_size = 32;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::Dictionary() {
+    allocateBuckets(TSmallCapacity > 0 ? 1 : 32);
+    m_count = 0;
 
     auto m = TLinkField;
     m_offset = *reinterpret_cast<size_t *>(&m);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::Dictionary(size_t n) {
-    n = calculateCapacity(n);
-
-    m_buckets = new Link<T>[n];
-    m_size = n;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::Dictionary(size_t n) {
+    allocateBuckets(calculateCapacity(n));
+    m_count = 0;
 
     auto m = TLinkField;
     m_offset = *reinterpret_cast<size_t *>(&m);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::resize(size_t n) {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::resize(size_t n) {
     n = calculateCapacity(n);
 
     if (!isEmpty()) {
         return false;
     }
 
-    delete[] m_buckets;
-    m_buckets = new Link<T>[n];
-    m_size = n;
+    freeBuckets();
+    allocateBuckets(n);
+    m_count = 0;
 
     return true;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::~Dictionary() {
-    unlinkAll();
-    if (nullptr != m_buckets) {
-        delete[] m_buckets;
-        m_buckets = nullptr;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::rehash(size_t n) {
+    n = calculateCapacity(n);
+    if (n == m_size) {
+        return;
+    }
+
+    Link<T> *oldBuckets = m_buckets;
+    size_t oldSize = m_size;
+    bool wasSmall = (m_buckets == &m_smallBucket);
+    allocateBuckets(n);
+
+    for (size_t i = 0; i < oldSize; i++) {
+        Link<T> *link = &(oldBuckets[i]);
+        Link<T> *next = link->nextLink();
+        while (link != next) {
+            Link<T> *tmp = next;
+            next = next->nextLink();
+
+            T *v = Link<T>::getData(tmp, m_offset);
+            getBucket(v->*TKeyField)->insertBefore(tmp);
+        }
+    }
+
+    if (!wasSmall) {
+        delete[] oldBuckets;
     }
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::calculateCapacity(size_t initialCapacity) {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::~Dictionary() {
+    unlinkAll();
+    freeBuckets();
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::calculateCapacity(size_t initialCapacity) {
+    if (initialCapacity <= TSmallCapacity) {
+        return 1;
+    }
+
     size_t capacity = 16;
     while (capacity < initialCapacity) {
         capacity <<= 1;
@@ -761,14 +1134,109 @@ size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::calculateCapacity(si
     return capacity;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-Link<T> *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::getBucket(const K &key) const {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::allocateBuckets(size_t n) {
+    m_buckets = (n == 1) ? &m_smallBucket : new Link<T>[n];
+    m_size = n;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::freeBuckets() {
+    if (m_buckets != &m_smallBucket) {
+        delete[] m_buckets;
+    }
+    m_buckets = nullptr;
+    m_size = 0;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::grow() {
+    m_count = countValues();
+    if (m_size == 1) {
+        // Switch from the inline bucket to a bucket array.
+        if (m_count > TSmallCapacity) {
+            rehash(2 * m_count);
+        }
+    } else if (m_count > m_size / 2) {
+        // Only grow if enough values are really linked, otherwise the recount is enough.
+        rehash(2 * m_count);
+    }
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::countValues() const {
+    size_t n = 0;
+    for (size_t i = 0; i < m_size; i++) {
+        Link<T> *link = &(m_buckets[i]);
+        for (Link<T> *next = link->nextLink(); next != link; next = next->nextLink()) {
+            n++;
+        }
+    }
+    return n;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+Link<T> *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::getBucket(const K &key) const {
+    if (m_size == 1) {
+        return m_buckets;
+    }
+
     size_t h = Hash()(key);
     return &(m_buckets[h & (m_size - 1)]);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::isEmpty() const {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+Link<T> *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::getBucketByHash(size_t hash) const {
+    return &(m_buckets[hash & (m_size - 1)]);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+T *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::findInBucket(Link<T> *bucket,
+                                                                                     const K &key) const {
+    Link<T> *next = bucket->nextLink();
+    while (next != bucket) {
+        T *v = Link<T>::getData(next, m_offset);
+        if (Pred()(key, v->*TKeyField)) {
+            return v;
+        }
+        next = next->nextLink();
+    }
+    return nullptr;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::insertInBucket(Link<T> *bucket, T *val) {
+    if (findInBucket(bucket, val->*TKeyField) != nullptr) {
+        return false;
+    }
+    bucket->insertBefore(val, m_offset);
+
+    if (++m_count > (m_size == 1 ? TSmallCapacity : m_size)) {
+        grow();
+    }
+    return true;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::bucketCount() const {
+    return m_size;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::isEmpty() const {
+    if (m_count == 0) {
+        return true;
+    }
     for (size_t i = 0; i < m_size; i++) {
         if (m_buckets[i].next(m_offset) != nullptr) {
             return false;
@@ -777,8 +1245,9 @@ bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::isEmpty() const {
     return true;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::countCollisions() const {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::countCollisions() const {
     size_t n = 0;
     for (size_t i = 0; i < m_size; i++) {
         Link<T> *link = &(m_buckets[i]);
@@ -794,8 +1263,9 @@ size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::countCollisions() co
     return n;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::unlinkAll() {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::unlinkAll() {
     for (size_t i = 0; i < m_size; i++) {
         Link<T> *link = &(m_buckets[i]);
         Link<T> *next = link->nextLink();
@@ -805,10 +1275,12 @@ void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::unlinkAll() {
             tmp->unlink();
         }
     }
+    m_count = 0;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::deleteAll() {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::deleteAll() {
     for (size_t i = 0; i < m_size; i++) {
         Link<T> *link = &(m_buckets[i]);
         Link<T> *next = link->nextLink();
@@ -818,69 +1290,630 @@ void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::deleteAll() {
             delete tmp->owner(m_offset);
         }
     }
+    m_count = 0;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-T *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::get(const K &key) const {
-    Link<T> *link = getBucket(key);
-    Link<T> *next = link->nextLink();
-    while (next != link) {
-        T *v = Link<T>::getData(next, m_offset);
-        if (Pred()(key, v->*TKeyField)) {
-            return v;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+T *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::get(const K &key) const {
+    return findInBucket(getBucket(key), key);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+T *Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::get(const K &key, size_t hash) const {
+    return findInBucket(m_size == 1 ? m_buckets : getBucketByHash(hash), key);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::put(T *val) {
+    return insertInBucket(getBucket(val->*TKeyField), val);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::put(T *val, size_t hash) {
+    return insertInBucket(m_size == 1 ? m_buckets : getBucketByHash(hash), val);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::prefetch(size_t hash) const {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(m_size == 1 ? m_buckets : getBucketByHash(hash));
+#else
+    (void)hash;
+#endif
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+template <typename TIterator>
+size_t Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::bulkLoad(TIterator first, TIterator last,
+                                                                     bool uniqueKeys) {
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    if (n == 0) {
+        return 0;
+    }
+
+    m_count = countValues();
+    size_t count = m_count + n;
+    if (count > (m_size == 1 ? TSmallCapacity : m_size)) {
+        rehash(count);
+    }
+
+    // First pass: hash every value and count the values of each bucket.
+    std::vector<size_t> bucketIndices(n);
+    std::vector<size_t> bucketStarts(m_size + 1, 0);
+    size_t i = 0;
+    for (TIterator it = first; it != last; ++it, ++i) {
+        T *val = *it;
+        bucketIndices[i] = static_cast<size_t>(getBucket(val->*TKeyField) - m_buckets);
+        bucketStarts[bucketIndices[i] + 1]++;
+    }
+    for (size_t b = 0; b < m_size; b++) {
+        bucketStarts[b + 1] += bucketStarts[b];
+    }
+
+    // Group the values by bucket (keeping the order of the range inside a bucket).
+    std::vector<T *> grouped(n);
+    i = 0;
+    for (TIterator it = first; it != last; ++it, ++i) {
+        grouped[bucketStarts[bucketIndices[i]]++] = *it;
+    }
+
+    // Second pass: link the values one bucket after the other.
+    // After grouping, bucketStarts[b] is the end of the values of bucket b.
+    size_t added = 0;
+    i = 0;
+    for (size_t b = 0; b < m_size; b++) {
+        Link<T> *link = &(m_buckets[b]);
+        for (; i < bucketStarts[b]; i++) {
+            T *val = grouped[i];
+            if (!uniqueKeys && findInBucket(link, val->*TKeyField) != nullptr) {
+                continue;
+            }
+            link->insertBefore(val, m_offset);
+            added++;
         }
-        next = next->nextLink();
     }
-    return nullptr;
+    m_count += added;
+    return added;
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-bool Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::put(T *val) {
-    Link<T> *link = getBucket(val->*TKeyField);
-    Link<T> *next = link->nextLink();
-    while (next != link) {
-        T *v = Link<T>::getData(next, m_offset);
-        if (Pred()(val->*TKeyField, v->*TKeyField)) {
-            return false;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::remove(T *val) {
+    assert(val != nullptr);
+    Link<T> *link = Link<T>::getLink(val, m_offset);
+    if (link->isLinked()) {
+        link->unlink();
+        if (m_count > 0) {
+            m_count--;
         }
-        next = next->nextLink();
     }
-    link->insertBefore(val, m_offset);
-    return true;
 }
 
 // ----------------------------------------------
 // ---- Dictionary iterators and std methods ----
 // ----------------------------------------------
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::iterator
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::begin() {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::iterator
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::begin() {
     return iterator(m_buckets, m_buckets + m_size, m_offset, 0);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::iterator
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::end() {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::iterator
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::end() {
     return iterator(m_buckets, m_buckets + m_size, m_offset, m_size);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::const_iterator
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::begin() const {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::const_iterator
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::begin() const {
     return const_iterator(m_buckets, m_buckets + m_size, m_offset, 0);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::const_iterator
-Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::end() const {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+typename Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::const_iterator
+Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::end() const {
     return const_iterator(m_buckets, m_buckets + m_size, m_offset, m_size);
 }
 
-template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred>
-void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred>::clear() {
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity>::clear() {
+    unlinkAll();
+}
+
+/// @brief Intrusive list that is kept ordered by a key field (smallest key at the head).
+/// Insertion scans from the tail, so keys that mostly grow (timestamps, expiry times) are inserted in O(1).
+/// @example Item ordered by expiry time:
+/// struct Item {
+///   long long expiry;
+///   Link<Item> _link;
+///   ...
+/// };
+/// SortedList<Item, long long, &Item::expiry, &Item::_link> byExpiry;
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Compare = std::less<K>>
+class SortedList : public List<T, TLinkField> {
+  public:
+    void insert(T *node);
+
+    /// @brief Moves the node to its new position after its key has been changed.
+    void update(T *node);
+};
+
+// --------------------
+// ---- SortedList ----
+// --------------------
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Compare>
+void SortedList<T, K, TKeyField, TLinkField, Compare>::insert(T *node) {
+    assert(node != nullptr);
+    this->remove(node);
+
+    // Equal keys keep their insertion order.
+    T *prev = this->tail();
+    while (prev != nullptr && Compare()(node->*TKeyField, prev->*TKeyField)) {
+        prev = this->prev(prev);
+    }
+
+    if (prev == nullptr) {
+        this->insertHead(node);
+    } else {
+        this->insertAfter(node, prev);
+    }
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Compare>
+void SortedList<T, K, TKeyField, TLinkField, Compare>::update(T *node) {
+    insert(node);
+}
+
+/// @brief Intrusive hierarchical hashed timer wheel: O(1) schedule and cancel, amortized O(1) expiration.
+/// The times are absolute ticks (e.g. milliseconds) chosen by the caller. There are Levels wheels of 64 slots:
+/// wheel l holds the nodes expiring in less than 64^(l+1) ticks and they are cascaded to the lower wheels
+/// as the time advances. Nodes expiring after 64^Levels ticks are parked in the last slot and cascaded again.
+/// @example Item expiring at a given time:
+/// struct Item {
+///   std::uint64_t expiresAt;
+///   Link<Item> _timerLink;
+///   ...
+/// };
+/// TimerWheel<Item, &Item::expiresAt, &Item::_timerLink> timers(now);
+/// timers.schedule(item);
+/// timers.advance(now, [](Item *expired) { ... });
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField> class TimerWheel {
+  public:
+    static const unsigned int Levels = 6;
+    static const unsigned int SlotBits = 6;
+    static const unsigned int Slots = 1 << SlotBits;
+
+    TimerWheel(std::uint64_t now = 0);
+    virtual ~TimerWheel();
+
+    /// @brief Schedules (or re-schedules) the node for node->*TExpiryField.
+    /// A node that is already expired will expire on the next advance.
+    void schedule(T *node);
+    void cancel(T *node);
+
+    /// @brief Moves the time forward and calls onExpired(T *) for every expired node.
+    /// The node is already unlinked from the wheel when onExpired is called, so it can be deleted.
+    /// @returns the number of expired nodes.
+    template <typename F> size_t advance(std::uint64_t now, F onExpired);
+
+    std::uint64_t now() const;
+    bool isEmpty() const;
+    void unlinkAll();
+
+  protected:
+    Link<T> m_slots[Levels][Slots];
+    // Bit i is set if slot i might be non-empty (nodes can unlink themselves, the bit is cleared lazily).
+    std::uint64_t m_used[Levels];
+    std::uint64_t m_now;
+    size_t m_offset;
+
+    void cascade(unsigned int level);
+    std::uint64_t nextCascade() const;
+    template <typename F> size_t expireSlot(unsigned int slot, F &onExpired);
+
+    // Hide copy-constructor and assignment operator
+    TimerWheel(const TimerWheel &) {}
+    TimerWheel &operator=(const TimerWheel &) { return *this; }
+};
+
+// --------------------
+// ---- TimerWheel ----
+// --------------------
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+TimerWheel<T, TExpiryField, TLinkField>::TimerWheel(std::uint64_t now) {
+    m_now = now;
+    for (unsigned int l = 0; l < Levels; l++) {
+        m_used[l] = 0;
+    }
+
+    auto m = TLinkField;
+    m_offset = *reinterpret_cast<size_t *>(&m);
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+TimerWheel<T, TExpiryField, TLinkField>::~TimerWheel() {
     unlinkAll();
 }
 
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+void TimerWheel<T, TExpiryField, TLinkField>::schedule(T *node) {
+    assert(node != nullptr);
+    std::uint64_t expiresAt = node->*TExpiryField;
+    if (expiresAt <= m_now) {
+        expiresAt = m_now + 1;
+    }
+
+    std::uint64_t delta = expiresAt - m_now;
+    unsigned int level = 0;
+    while (level < Levels - 1 && delta >= (std::uint64_t(1) << (SlotBits * (level + 1)))) {
+        level++;
+    }
+    if (level == Levels - 1 && delta >= (std::uint64_t(1) << (SlotBits * Levels))) {
+        // Too far in the future: park it in the last slot reachable by the last wheel.
+        expiresAt = m_now + (std::uint64_t(1) << (SlotBits * Levels)) - 1;
+    }
+
+    unsigned int slot = static_cast<unsigned int>((expiresAt >> (SlotBits * level)) & (Slots - 1));
+    m_slots[level][slot].insertBefore(node, m_offset);
+    m_used[level] |= std::uint64_t(1) << slot;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+void TimerWheel<T, TExpiryField, TLinkField>::cancel(T *node) {
+    assert(node != nullptr);
+    Link<T>::getLink(node, m_offset)->unlink();
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+template <typename F>
+size_t TimerWheel<T, TExpiryField, TLinkField>::advance(std::uint64_t now, F onExpired) {
+    size_t expired = 0;
+    while (m_now < now) {
+        if (m_used[0] == 0) {
+            // The first wheel is empty: jump over its turns up to the next cascade bringing nodes down.
+            std::uint64_t next = nextCascade();
+            if (next > now) {
+                m_now = now;
+                break;
+            }
+            m_now = next - 1;
+        }
+
+        std::uint64_t tick = m_now + 1;
+        if ((tick & (Slots - 1)) != 0) {
+            // Jump over the empty slots of the first wheel, up to the next cascade.
+            std::uint64_t last = (now < (tick | (Slots - 1))) ? now : (tick | (Slots - 1));
+            unsigned int first = static_cast<unsigned int>(tick & (Slots - 1));
+            std::uint64_t used = (m_used[0] >> first) << first;
+            unsigned int lastSlot = static_cast<unsigned int>(last & (Slots - 1));
+            if (lastSlot < Slots - 1) {
+                used &= (std::uint64_t(1) << (lastSlot + 1)) - 1;
+            }
+            if (used == 0) {
+                m_now = last;
+                continue;
+            }
+
+            unsigned int slot = first;
+            while ((used & (std::uint64_t(1) << slot)) == 0) {
+                slot++;
+            }
+            tick = (tick & ~std::uint64_t(Slots - 1)) + slot;
+        }
+
+        m_now = tick;
+        if ((tick & (Slots - 1)) == 0) {
+            // The first wheel wrapped: bring the nodes of the next slot of the upper wheels down.
+            for (unsigned int level = 1; level < Levels; level++) {
+                cascade(level);
+                if (((tick >> (SlotBits * level)) & (Slots - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+        expired += expireSlot(static_cast<unsigned int>(tick & (Slots - 1)), onExpired);
+    }
+    return expired;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+void TimerWheel<T, TExpiryField, TLinkField>::cascade(unsigned int level) {
+    unsigned int slot = static_cast<unsigned int>((m_now >> (SlotBits * level)) & (Slots - 1));
+    if ((m_used[level] & (std::uint64_t(1) << slot)) == 0) {
+        return;
+    }
+    m_used[level] &= ~(std::uint64_t(1) << slot);
+
+    // Move the nodes to a temporary list first, they might be scheduled in the same slot again.
+    Link<T> pending;
+    Link<T> *link = &(m_slots[level][slot]);
+    if (link->nextLink() != link) {
+        pending.spliceBefore(link->nextLink(), link->prevLink());
+    }
+    while (pending.nextLink() != &pending) {
+        schedule(Link<T>::getData(pending.nextLink(), m_offset));
+    }
+}
+
+// The first tick after now at which an upper wheel has a slot to cascade, or -1 if they are all empty.
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+std::uint64_t TimerWheel<T, TExpiryField, TLinkField>::nextCascade() const {
+    std::uint64_t next = ~std::uint64_t(0);
+    for (unsigned int level = 1; level < Levels; level++) {
+        if (m_used[level] == 0) {
+            continue;
+        }
+        // The wheel cascades a slot when the wheels below it wrap: on the multiples of its slot duration.
+        unsigned int shift = SlotBits * level;
+        std::uint64_t tick = ((m_now >> shift) + 1) << shift;
+        unsigned int slot = static_cast<unsigned int>((tick >> shift) & (Slots - 1));
+        // The used slots from slot on, then the ones before it (reached after a turn of the wheel).
+        std::uint64_t used = (m_used[level] >> slot) | (slot != 0 ? m_used[level] << (Slots - slot) : 0);
+        unsigned int distance = 0;
+        while ((used & (std::uint64_t(1) << distance)) == 0) {
+            distance++;
+        }
+        tick += std::uint64_t(distance) << shift;
+        next = (tick < next) ? tick : next;
+    }
+    return next;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+template <typename F>
+size_t TimerWheel<T, TExpiryField, TLinkField>::expireSlot(unsigned int slot, F &onExpired) {
+    m_used[0] &= ~(std::uint64_t(1) << slot);
+
+    size_t expired = 0;
+    Link<T> *link = &(m_slots[0][slot]);
+    while (link->nextLink() != link) {
+        Link<T> *next = link->nextLink();
+        next->unlink();
+        T *node = Link<T>::getData(next, m_offset);
+        if (node->*TExpiryField > m_now) {
+            // Parked node that is still not expired
+            schedule(node);
+        } else {
+            expired++;
+            onExpired(node);
+        }
+    }
+    return expired;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+std::uint64_t TimerWheel<T, TExpiryField, TLinkField>::now() const {
+    return m_now;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+bool TimerWheel<T, TExpiryField, TLinkField>::isEmpty() const {
+    for (unsigned int l = 0; l < Levels; l++) {
+        for (unsigned int i = 0; i < Slots; i++) {
+            if (m_slots[l][i].isLinked()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename T, std::uint64_t T::*TExpiryField, Link<T> T::*TLinkField>
+void TimerWheel<T, TExpiryField, TLinkField>::unlinkAll() {
+    for (unsigned int l = 0; l < Levels; l++) {
+        for (unsigned int i = 0; i < Slots; i++) {
+            Link<T> *link = &(m_slots[l][i]);
+            while (link->nextLink() != link) {
+                link->nextLink()->unlink();
+            }
+        }
+        m_used[l] = 0;
+    }
+}
+
+namespace detail {
+
+// Adapters used by MultiIndex to treat every container as an index.
+template <typename T, Link<T> T::*TLinkField> bool indexInsert(List<T, TLinkField> &index, T *node) {
+    index.insertHead(node);
+    return true;
+}
+
+template <typename T, Link<T> T::*TLinkField> void indexTouch(List<T, TLinkField> &index, T *node) {
+    index.insertHead(node);
+}
+
+template <typename T, Link<T> T::*TLinkField> void indexRemove(List<T, TLinkField> &index, T *node) {
+    index.remove(node);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Compare>
+bool indexInsert(SortedList<T, K, TKeyField, TLinkField, Compare> &index, T *node) {
+    index.insert(node);
+    return true;
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Compare>
+void indexTouch(SortedList<T, K, TKeyField, TLinkField, Compare> &index, T *node) {
+    index.update(node);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+bool indexInsert(HashSet<T, TLinkField, Hash, Pred> &index, T *node) {
+    return index.put(node);
+}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+void indexTouch(HashSet<T, TLinkField, Hash, Pred> &, T *) {}
+
+template <typename T, Link<T> T::*TLinkField, typename Hash, typename Pred>
+void indexRemove(HashSet<T, TLinkField, Hash, Pred> &index, T *node) {
+    index.remove(node);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool indexInsert(Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity> &index, T *node) {
+    return index.put(node);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void indexTouch(Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity> &, T *) {}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+void indexRemove(Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity> &index, T *node) {
+    index.remove(node);
+}
+
+// Only the dictionaries make use of a precomputed hash of the key.
+template <typename TIndex, typename T> bool indexInsertHashed(TIndex &index, T *node, std::size_t) {
+    return indexInsert(index, node);
+}
+
+template <typename T, typename K, K T::*TKeyField, Link<T> T::*TLinkField, typename Hash, typename Pred,
+          size_t TSmallCapacity>
+bool indexInsertHashed(Dictionary<T, K, TKeyField, TLinkField, Hash, Pred, TSmallCapacity> &index, T *node,
+                       std::size_t hash) {
+    return index.put(node, hash);
+}
+
+template <std::size_t I, std::size_t N> struct MultiIndexOps {
+    template <typename TTuple, typename T> static bool insert(TTuple &indices, T *node) {
+        if (!indexInsert(std::get<I>(indices), node)) {
+            return false;
+        }
+        if (!MultiIndexOps<I + 1, N>::insert(indices, node)) {
+            indexRemove(std::get<I>(indices), node);
+            return false;
+        }
+        return true;
+    }
+
+    template <typename TTuple, typename T> static bool insert(TTuple &indices, T *node, std::size_t hash) {
+        if (!indexInsertHashed(std::get<I>(indices), node, hash)) {
+            return false;
+        }
+        if (!MultiIndexOps<I + 1, N>::insert(indices, node, hash)) {
+            indexRemove(std::get<I>(indices), node);
+            return false;
+        }
+        return true;
+    }
+
+    template <typename TTuple, typename T> static void touch(TTuple &indices, T *node) {
+        indexTouch(std::get<I>(indices), node);
+        MultiIndexOps<I + 1, N>::touch(indices, node);
+    }
+
+    template <typename TTuple, typename T> static void remove(TTuple &indices, T *node) {
+        indexRemove(std::get<I>(indices), node);
+        MultiIndexOps<I + 1, N>::remove(indices, node);
+    }
+
+    template <typename TTuple> static void unlinkAll(TTuple &indices) {
+        std::get<I>(indices).unlinkAll();
+        MultiIndexOps<I + 1, N>::unlinkAll(indices);
+    }
+};
+
+template <std::size_t N> struct MultiIndexOps<N, N> {
+    template <typename TTuple, typename T> static bool insert(TTuple &, T *) { return true; }
+    template <typename TTuple, typename T> static bool insert(TTuple &, T *, std::size_t) { return true; }
+    template <typename TTuple, typename T> static void touch(TTuple &, T *) {}
+    template <typename TTuple, typename T> static void remove(TTuple &, T *) {}
+    template <typename TTuple> static void unlinkAll(TTuple &) {}
+};
+
+} // namespace detail
+
+/// @brief Several intrusive indices (List, SortedList, HashSet, Dictionary) over the same node type,
+/// each using its own Link field. All the indices are updated together by a single call.
+/// @example Item searchable by key, in LRU order and ordered by expiry:
+/// struct Item {
+///   int key;
+///   long long expiry;
+///   Link<Item> _dictLink;
+///   Link<Item> _lruLink;
+///   Link<Item> _expiryLink;
+///   ...
+/// };
+/// MultiIndex<Item, Dictionary<Item, int, &Item::key, &Item::_dictLink>, List<Item, &Item::_lruLink>,
+///            SortedList<Item, long long, &Item::expiry, &Item::_expiryLink>> items;
+template <typename T, typename... TIndices> class MultiIndex {
+  public:
+    using Indices = std::tuple<TIndices...>;
+
+    /// @brief Links the node into all the indices (lists insert it at the head).
+    /// @returns false and leaves the node unlinked if one of the indices rejects it (duplicate key).
+    bool insert(T *node);
+
+    /// @brief Same as insert, the dictionaries use the precomputed hash of the key instead of hashing it again.
+    bool insert(T *node, std::size_t hash);
+
+    /// @brief Marks the node as used: lists move it to the head, sorted lists re-position it.
+    void touch(T *node);
+
+    void remove(T *node);
+
+    bool isEmpty() const;
+    void unlinkAll();
+
+    template <std::size_t I> typename std::tuple_element<I, Indices>::type &index() { return std::get<I>(m_indices); }
+
+    template <std::size_t I> const typename std::tuple_element<I, Indices>::type &index() const {
+        return std::get<I>(m_indices);
+    }
+
+  protected:
+    Indices m_indices;
+};
+
+// --------------------
+// ---- MultiIndex ----
+// --------------------
+template <typename T, typename... TIndices> bool MultiIndex<T, TIndices...>::insert(T *node) {
+    assert(node != nullptr);
+    return detail::MultiIndexOps<0, sizeof...(TIndices)>::insert(m_indices, node);
+}
+
+template <typename T, typename... TIndices> bool MultiIndex<T, TIndices...>::insert(T *node, std::size_t hash) {
+    assert(node != nullptr);
+    return detail::MultiIndexOps<0, sizeof...(TIndices)>::insert(m_indices, node, hash);
+}
+
+template <typename T, typename... TIndices> void MultiIndex<T, TIndices...>::touch(T *node) {
+    assert(node != nullptr);
+    detail::MultiIndexOps<0, sizeof...(TIndices)>::touch(m_indices, node);
+}
+
+template <typename T, typename... TIndices> void MultiIndex<T, TIndices...>::remove(T *node) {
+    assert(node != nullptr);
+    detail::MultiIndexOps<0, sizeof...(TIndices)>::remove(m_indices, node);
+}
+
+template <typename T, typename... TIndices> bool MultiIndex<T, TIndices...>::isEmpty() const {
+    // All the indices contain the same nodes
+    return std::get<0>(m_indices).isEmpty();
+}
+
+template <typename T, typename... TIndices> void MultiIndex<T, TIndices...>::unlinkAll() {
+    detail::MultiIndexOps<0, sizeof...(TIndices)>::unlinkAll(m_indices);
+}
+
 } // namespace galib
 
 #ifdef _u_needed_to_undefine_assert
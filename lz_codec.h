@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace galib {
+
+// Fast LZ77 codec without dependencies, with LZ4-style sequences: a sequence is a token (4 bits of literal length,
+// 4 bits of match length - 4), the extra literal length, the literals, the offset of the match (2 bytes, little
+// endian, up to 64 KB back) and the extra match length. The extra lengths are runs of 255 ended by a smaller byte.
+// The last sequence only has literals. It is not the LZ4 block format: the compressed data starts with the size of
+// the data (varint), and a match can end at the end of the data (LZ4 keeps the last bytes as literals).
+// It trades ratio for speed: a single probe of a hash table, no entropy coding.
+
+namespace detail {
+
+const size_t lzMinMatch = 4;
+const size_t lzMaxOffset = 65535;
+const unsigned int lzMaxHashBits = 12;
+
+inline std::uint32_t lzRead32(const unsigned char *p) {
+    std::uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline void lzAppendLength(std::string &out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+inline bool lzReadLength(const unsigned char *&pos, const unsigned char *end, size_t &length) {
+    unsigned char byte = 255;
+    while (byte == 255) {
+        if (pos == end) {
+            return false;
+        }
+        byte = *pos++;
+        length += byte;
+    }
+    return true;
+}
+
+inline void lzAppendSequence(std::string &out, const unsigned char *literals, size_t literalCount, size_t offset,
+                             size_t matchLength) {
+    size_t extraMatch = matchLength - lzMinMatch;
+    unsigned char token = static_cast<unsigned char>(((literalCount < 15 ? literalCount : 15) << 4) |
+                                                     (extraMatch < 15 ? extraMatch : 15));
+    out.push_back(static_cast<char>(token));
+    if (literalCount >= 15) {
+        lzAppendLength(out, literalCount - 15);
+    }
+    out.append(reinterpret_cast<const char *>(literals), literalCount);
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (extraMatch >= 15) {
+        lzAppendLength(out, extraMatch - 15);
+    }
+}
+
+} // namespace detail
+
+/// @brief Compresses size bytes of data, appended to out (see lzDecompress).
+inline void lzCompress(const char *data, size_t size, std::string &out) {
+    for (std::uint64_t n = size; true; n >>= 7) {
+        out.push_back(static_cast<char>((n & 0x7f) | (n >= 0x80 ? 0x80 : 0)));
+        if (n < 0x80) {
+            break;
+        }
+    }
+
+    // Small inputs use a part of the table: clearing it is most of their cost.
+    unsigned int hashBits = 8;
+    while (hashBits < detail::lzMaxHashBits && (size_t(1) << hashBits) < size) {
+        hashBits++;
+    }
+    std::uint32_t table[1 << detail::lzMaxHashBits];
+    std::memset(table, 0, sizeof(std::uint32_t) << hashBits);
+
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(data);
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + detail::lzMinMatch <= size) {
+        std::uint32_t sequence = detail::lzRead32(src + pos);
+        std::uint32_t &slot = table[(sequence * 2654435761u) >> (32 - hashBits)];
+        // Positions are stored modulo 2^32, their distance is exact up to the window size.
+        size_t offset = static_cast<std::uint32_t>(pos) - slot;
+        slot = static_cast<std::uint32_t>(pos);
+        if (offset == 0 || offset > detail::lzMaxOffset || detail::lzRead32(src + pos - offset) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t length = detail::lzMinMatch;
+        while (pos + length < size && src[pos + length] == src[pos + length - offset]) {
+            length++;
+        }
+        detail::lzAppendSequence(out, src + anchor, pos - anchor, offset, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    size_t literalCount = size - anchor;
+    out.push_back(static_cast<char>((literalCount < 15 ? literalCount : 15) << 4));
+    if (literalCount >= 15) {
+        detail::lzAppendLength(out, literalCount - 15);
+    }
+    out.append(data + anchor, literalCount);
+}
+
+/// @brief Decompresses data written by lzCompress, appended to out.
+/// @returns false if the data is not valid, out is then left with an unspecified content.
+inline bool lzDecompress(const char *data, size_t size, std::string &out) {
+    const unsigned char *pos = reinterpret_cast<const unsigned char *>(data);
+    const unsigned char *end = pos + size;
+    std::uint64_t decodedSize = 0;
+    for (unsigned int shift = 0; true; shift += 7) {
+        if (pos == end || shift > 63) {
+            return false;
+        }
+        decodedSize |= static_cast<std::uint64_t>(*pos & 0x7f) << shift;
+        if ((*pos++ & 0x80) == 0) {
+            break;
+        }
+    }
+    // A byte of input expands to at most 255 bytes: do not trust a larger size.
+    if (decodedSize / 255 > static_cast<std::uint64_t>(end - pos)) {
+        return false;
+    }
+
+    size_t base = out.size();
+    out.resize(base + static_cast<size_t>(decodedSize));
+    unsigned char *dstBegin = reinterpret_cast<unsigned char *>(&out[0]) + base;
+    unsigned char *dst = dstBegin;
+    unsigned char *dstEnd = dstBegin + decodedSize;
+    while (pos < end) {
+        unsigned char token = *pos++;
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !detail::lzReadLength(pos, end, literalCount)) {
+            return false;
+        }
+        if (literalCount > static_cast<size_t>(end - pos) || literalCount > static_cast<size_t>(dstEnd - dst)) {
+            return false;
+        }
+        std::memcpy(dst, pos, literalCount);
+        dst += literalCount;
+        pos += literalCount;
+        if (pos == end) {
+            break;
+        }
+
+        if (end - pos < 2) {
+            return false;
+        }
+        size_t offset = pos[0] | (static_cast<size_t>(pos[1]) << 8);
+        pos += 2;
+        size_t length = token & 15;
+        if (length == 15 && !detail::lzReadLength(pos, end, length)) {
+            return false;
+        }
+        length += detail::lzMinMatch;
+        if (offset == 0 || offset > static_cast<size_t>(dst - dstBegin) ||
+            length > static_cast<size_t>(dstEnd - dst)) {
+            return false;
+        }
+        const unsigned char *match = dst - offset;
+        if (offset >= length) {
+            std::memcpy(dst, match, length);
+            dst += length;
+        } else {
+            // Overlapping match: repeats the last offset bytes.
+            for (size_t i = 0; i < length; i++) {
+                *dst++ = match[i];
+            }
+        }
+    }
+    return dst == dstEnd;
+}
+
+} // namespace galib
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace galib {
+
+/// @brief Thread-safe cache made of TShardCount independent caches (shards), each one with its own lock.
+/// A key always goes to the same shard, so threads working on different shards do not contend.
+/// The level limits are split between the shards, the hard limits (configureCapacity) are global: a hot shard can
+/// use the memory left by the cold ones.
+/// @example TCache is a Cache (usually a subclass implementing newCacheValue):
+/// class FileCache : public Cache<std::string, FileInfo, 2> { ... };
+/// ShardedCache<FileCache> files;
+/// files.configureLevel(0, 100000, 64 * 1024 * 1024);
+/// FileInfo info = files.get("/etc/hosts");
+template <typename TCache, unsigned int TShardCount = 16> class ShardedCache {
+  public:
+    typedef typename TCache::key_type key_type;
+    typedef typename TCache::value_type value_type;
+    static const unsigned int levelCount = TCache::levelCount;
+
+  public:
+    ShardedCache()
+        : _count(0)
+        , _memUsage(0)
+        , _maxCount(static_cast<size_t>(-1))
+        , _maxMemUsage(static_cast<size_t>(-1)) {}
+
+    virtual ~ShardedCache() {}
+
+    /// @brief Splits the limits of the level evenly between the shards.
+    void configureLevel(int level, unsigned int maxCount, size_t maxMemUsage) {
+        unsigned int shardMaxCount = (maxCount + TShardCount - 1) / TShardCount;
+        size_t shardMaxMemUsage = (maxMemUsage + TShardCount - 1) / TShardCount;
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            _shards[i]._cache.configureLevel(level, shardMaxCount, shardMaxMemUsage);
+        }
+    }
+
+    /// @brief Hard limits for all the shards together (see Cache::configureCapacity). They are not split: when an
+    /// operation leaves the cache over them, its shard evicts its victims (Cache::evictVictim) until the cache is back
+    /// under them. Unlimited by default. Lowering the limits evicts the values over them immediately.
+    void configureCapacity(size_t maxCount, size_t maxMemUsage) {
+        _maxCount.store(maxCount, std::memory_order_relaxed);
+        _maxMemUsage.store(maxMemUsage, std::memory_order_relaxed);
+        for (unsigned int i = 0; i < TShardCount && isOverCapacity(); i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            UsageGuard usage(*this, _shards[i]._cache);
+        }
+    }
+
+    value_type get(const key_type &key, int levelIndex = -1) {
+        return apply(key, [&](TCache &cache) { return cache.get(key, levelIndex); });
+    }
+
+    /// @brief Like get, but the value is not copied: it is pinned until the handle is released (by any thread).
+    typename TCache::Handle getHandle(const key_type &key, int levelIndex = -1) {
+        return apply(key, [&](TCache &cache) { return cache.getHandle(key, levelIndex); });
+    }
+
+    /// @brief Same as out[i] = get(keys[i], levelIndex) for each key. The keys are grouped by shard: the lock of each
+    /// shard is taken once and its keys are resolved with Cache::getMany.
+    /// @returns the number of keys found in the cache (the others were created).
+    size_t getMany(const key_type *keys, size_t count, value_type *out, int levelIndex = -1) {
+        // Counting sort of the positions of the keys by shard.
+        std::vector<unsigned int> shards(count);
+        size_t starts[TShardCount + 1] = {};
+        for (size_t i = 0; i < count; i++) {
+            shards[i] = shardIndex(keys[i]);
+            starts[shards[i] + 1]++;
+        }
+        for (unsigned int s = 0; s < TShardCount; s++) {
+            starts[s + 1] += starts[s];
+        }
+        std::vector<size_t> positions(count);
+        size_t next[TShardCount];
+        std::copy(starts, starts + TShardCount, next);
+        for (size_t i = 0; i < count; i++) {
+            positions[next[shards[i]]++] = i;
+        }
+
+        size_t hits = 0;
+        std::vector<key_type> shardKeys;
+        std::vector<value_type> shardValues;
+        for (unsigned int s = 0; s < TShardCount; s++) {
+            if (starts[s] == starts[s + 1]) {
+                continue;
+            }
+            shardKeys.clear();
+            for (size_t p = starts[s]; p < starts[s + 1]; p++) {
+                shardKeys.push_back(keys[positions[p]]);
+            }
+            shardValues.resize(shardKeys.size());
+            {
+                std::lock_guard<std::mutex> lock(_shards[s]._mutex);
+                UsageGuard usage(*this, _shards[s]._cache);
+                hits += _shards[s]._cache.getMany(shardKeys.data(), shardKeys.size(), shardValues.data(), levelIndex);
+            }
+            for (size_t p = starts[s]; p < starts[s + 1]; p++) {
+                out[positions[p]] = std::move(shardValues[p - starts[s]]);
+            }
+        }
+        return hits;
+    }
+
+    value_type find(const key_type &key) {
+        return apply(key, [&](TCache &cache) { return cache.find(key); });
+    }
+
+    void remove(const key_type &key) {
+        apply(key, [&](TCache &cache) { cache.remove(key); });
+    }
+
+    bool setTag(const key_type &key, const std::string &tag) {
+        return apply(key, [&](TCache &cache) { return cache.setTag(key, tag); });
+    }
+
+    /// @brief Removes the values with the tag from all the shards (see Cache::invalidateTag).
+    size_t invalidateTag(const std::string &tag) {
+        return applyAll([&](TCache &cache) { return cache.invalidateTag(tag); });
+    }
+
+    void configurePrefixIndex(char separator) {
+        applyAll([&](TCache &cache) {
+            cache.configurePrefixIndex(separator);
+            return 0;
+        });
+    }
+
+    /// @brief Removes the values whose key starts with prefix from all the shards (see Cache::invalidatePrefix).
+    size_t invalidatePrefix(const std::string &prefix) {
+        return applyAll([&](TCache &cache) { return cache.invalidatePrefix(prefix); });
+    }
+
+    /// @brief Runs fn(TCache &) on the shard of the key while holding the lock of the shard.
+    /// The pointers returned by the shard (getPtr, getKeyValue...) are only valid inside fn.
+    template <typename F> auto apply(const key_type &key, F fn) -> decltype(fn(std::declval<TCache &>())) {
+        Shard &shard = _shards[shardIndex(key)];
+        std::lock_guard<std::mutex> lock(shard._mutex);
+        UsageGuard usage(*this, shard._cache);
+        return fn(shard._cache);
+    }
+
+    /// @brief Number of values in all the shards. Does not take any lock.
+    size_t getTotalCount() const { return _count.load(std::memory_order_relaxed); }
+
+    /// @brief Memory used by all the shards. Does not take any lock.
+    size_t getTotalMemUsage() const { return _memUsage.load(std::memory_order_relaxed); }
+
+    /// @brief Statistics of the level, summed over all the shards. Does not take any lock.
+    CacheLevelStats getStats(int level) const {
+        CacheLevelStats stats;
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            stats += _shards[i]._cache.getStats(level);
+        }
+        return stats;
+    }
+
+    /// @brief See Cache::configureHitStats, the hits are needed by a CacheBudgetMember.
+    void configureHitStats(bool enabled) {
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            _shards[i]._cache.configureHitStats(enabled);
+        }
+    }
+
+    void configureLatencySampling(unsigned int sampleEvery) {
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            _shards[i]._cache.configureLatencySampling(sampleEvery);
+        }
+    }
+
+    /// @brief Records the operations of all the shards in the trace (see Cache::configureTrace), which must be
+    /// thread-safe: e.g. CacheTrace.
+    void configureTrace(CacheTraceSink *trace) {
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            _shards[i]._cache.configureTrace(trace);
+        }
+    }
+
+    /// @brief Sampled latencies of all the shards. Does not take any lock.
+    CacheLatencyHistogram getLatencyHistogram() const {
+        CacheLatencyHistogram histogram;
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            CacheLatencyHistogram shard = _shards[i]._cache.getLatencyHistogram();
+            for (unsigned int b = 0; b < CacheLatencyHistogram::bucketCount; b++) {
+                histogram.buckets[b] += shard.buckets[b];
+            }
+        }
+        return histogram;
+    }
+
+    static unsigned int shardIndex(const key_type &key) {
+        // Mix the bits, the dictionaries of the shards use the low bits of the same hash.
+        unsigned long long h = std::hash<key_type>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<unsigned int>(h % TShardCount);
+    }
+
+  private:
+    // Runs fn(TCache &) on every shard, one lock at a time, and sums the results.
+    template <typename F> size_t applyAll(F fn) {
+        size_t sum = 0;
+        for (unsigned int i = 0; i < TShardCount; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i]._mutex);
+            UsageGuard usage(*this, _shards[i]._cache);
+            sum += fn(_shards[i]._cache);
+        }
+        return sum;
+    }
+
+    bool isOverCapacity() const {
+        return (_count.load(std::memory_order_relaxed) > _maxCount.load(std::memory_order_relaxed)) ||
+               (_memUsage.load(std::memory_order_relaxed) > _maxMemUsage.load(std::memory_order_relaxed));
+    }
+
+    // Publishes the changes of the usage of a shard to the global accounting, then enforces the global limits on the
+    // shard (while the shard is locked).
+    class UsageGuard {
+      public:
+        UsageGuard(ShardedCache &owner, TCache &cache)
+            : _owner(owner)
+            , _cache(cache)
+            , _count(cache.getTotalCount())
+            , _memUsage(cache.getTotalMemUsage()) {}
+
+        ~UsageGuard() {
+            publish();
+            while (_owner.isOverCapacity() && _cache.evictVictim()) {
+                publish();
+            }
+        }
+
+      private:
+        void publish() {
+            size_t count = _cache.getTotalCount();
+            size_t memUsage = _cache.getTotalMemUsage();
+            _owner._count.fetch_add(count - _count, std::memory_order_relaxed);
+            _owner._memUsage.fetch_add(memUsage - _memUsage, std::memory_order_relaxed);
+            _count = count;
+            _memUsage = memUsage;
+        }
+
+        ShardedCache &_owner;
+        TCache &_cache;
+        size_t _count;
+        size_t _memUsage;
+    };
+
+    // Each shard on its own cache lines, so that the locks do not share lines.
+    struct alignas(64) Shard {
+        std::mutex _mutex;
+        TCache _cache;
+    };
+
+    Shard _shards[TShardCount];
+
+    std::atomic<size_t> _count;
+    std::atomic<size_t> _memUsage;
+    std::atomic<size_t> _maxCount;
+    std::atomic<size_t> _maxMemUsage;
+};
+
+} // namespace galib
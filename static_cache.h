@@ -0,0 +1,103 @@
+#pragma once
+
+#include "cache.h"
+
+#include <functional>
+#include <memory>
+
+namespace galib {
+
+/// @brief Cache whose nodes and index are allocated once, at construction, for threads that must not allocate.
+/// The nodes come from a slab of TCapacity nodes and go back to a free list when they are deleted. When the slab is
+/// empty, a value is evicted to make room (see Cache::evictOne): the cache never holds more than TCapacity values and
+/// negative entries, whatever the limits of its levels. A snapshot is loaded up to TCapacity values, the most recent.
+/// No allocation happens after the construction as long as:
+///  - the keys and values do not allocate (std::string keys and values reuse the memory of the recycled nodes),
+///  - the policy does not allocate: LruPolicy, SlruPolicy and ClockPolicy never do, the ghost lists of TwoQPolicy
+///    and ArcPolicy do until they are full,
+///  - no value has a time to live (the timer wheel is allocated with the first one) and the admission filter is
+///    configured at startup.
+/// If all the nodes are pinned by handles, the slab cannot be recycled: the next nodes are allocated on the heap.
+/// @example class Prices : public StaticCache<std::uint64_t, Price, 2, 4096> {
+///   protected:
+///     bool loadValue(const std::uint64_t &id, Price &price) override { return readPrice(id, price); }
+/// };
+template <typename TCacheKey, typename TCacheValue, unsigned int TMaxLevel, size_t TCapacity,
+          typename TPolicy = LruPolicy>
+class StaticCache : public Cache<TCacheKey, TCacheValue, TMaxLevel, InlineCacheValue, TPolicy> {
+    typedef Cache<TCacheKey, TCacheValue, TMaxLevel, InlineCacheValue, TPolicy> Base;
+
+  public:
+    typedef typename Base::KeyValue KeyValue;
+    static const size_t capacity = TCapacity;
+
+  public:
+    StaticCache()
+        : _slab(new KeyValue[TCapacity]) {
+        for (size_t i = 0; i < TCapacity; i++) {
+            _free.insertTail(&_slab[i]);
+        }
+        _freeCount = TCapacity;
+        this->reserve(TCapacity);
+    }
+
+    ~StaticCache() override { this->clear(); }
+
+    /// @brief Number of nodes of the slab that are not used.
+    size_t getFreeCount() const { return _freeCount; }
+
+  protected:
+    /// @brief Loads the value of a missing key. value is default constructed, or reset with a default constructed
+    /// value if its node is recycled.
+    /// @returns false if the key does not exist.
+    virtual bool loadValue(const TCacheKey &, TCacheValue &) { return true; }
+
+    KeyValue *newCacheValue(const TCacheKey &key, int) override {
+        KeyValue *kv = newKeyValue();
+        if (!loadValue(key, kv->value())) {
+            deleteCacheValue(kv);
+            return nullptr;
+        }
+        return kv;
+    }
+
+    KeyValue *newKeyValue() override {
+        if (_free.isEmpty()) {
+            this->evictOne();
+        }
+        KeyValue *kv = _free.head();
+        if (kv == nullptr) {
+            return new KeyValue();
+        }
+        _free.remove(kv);
+        _freeCount--;
+
+        // The fields that the cache expects to be default initialized.
+        kv->_segment = 0;
+        kv->_negative = false;
+        kv->_packed = false;
+        kv->_expiresAt = 0;
+        kv->value() = TCacheValue();
+        return kv;
+    }
+
+    size_t getNodeBudget() const override { return _freeCount; }
+
+    void deleteCacheValue(KeyValue *kv) override {
+        std::less<const KeyValue *> less;
+        if (less(kv, &_slab[0]) || !less(kv, &_slab[0] + TCapacity)) {
+            delete kv;
+            return;
+        }
+        _free.insertHead(kv);
+        _freeCount++;
+    }
+
+  private:
+    std::unique_ptr<KeyValue[]> _slab;
+    // Recycled through KeyValue::_listLink: the free nodes are in no level.
+    typename Base::CacheValueList _free;
+    size_t _freeCount = 0;
+};
+
+} // namespace galib
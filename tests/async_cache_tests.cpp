@@ -0,0 +1,116 @@
+#include "async_cache.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace galib;
+
+typedef Cache<int, long long, 2> SquareValues;
+
+TEST(AsyncCacheTest, SingleFlight) {
+    std::atomic<int> loads(0);
+    std::atomic<bool> release(false);
+    AsyncCache<SquareValues, 4> cache(
+        [&](const int &key) {
+            loads++;
+            while (!release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return static_cast<long long>(key) * key;
+        },
+        2);
+
+    // Concurrent misses on the same key share the load.
+    std::vector<std::shared_future<long long>> results;
+    for (int i = 0; i < 10; i++) {
+        results.push_back(cache.getAsync(7));
+    }
+    EXPECT_EQ(1, cache.getPendingCount());
+    release = true;
+    for (std::shared_future<long long> &result : results) {
+        EXPECT_EQ(49, result.get());
+    }
+    EXPECT_EQ(1, loads.load());
+
+    // The value is in the cache: the future is ready and nothing is loaded.
+    std::shared_future<long long> hit = cache.getAsync(7);
+    EXPECT_EQ(std::future_status::ready, hit.wait_for(std::chrono::seconds(0)));
+    EXPECT_EQ(49, hit.get());
+    EXPECT_EQ(1, loads.load());
+    EXPECT_EQ(0, cache.getPendingCount());
+    EXPECT_EQ(1, cache.cache().getTotalCount());
+}
+
+TEST(AsyncCacheTest, LoaderFailure) {
+    std::atomic<int> loads(0);
+    AsyncCache<SquareValues, 4> cache([&](const int &key) -> long long {
+        if (loads++ == 0) {
+            throw std::runtime_error("backend down");
+        }
+        return key;
+    });
+
+    EXPECT_THROW(cache.getAsync(3).get(), std::runtime_error);
+    EXPECT_EQ(0, cache.cache().getTotalCount());
+    // Nothing was cached: the next get loads again.
+    EXPECT_EQ(3, cache.getAsync(3).get());
+    EXPECT_EQ(2, loads.load());
+}
+
+TEST(AsyncCacheTest, ConcurrentGets) {
+    std::atomic<int> loads(0);
+    AsyncCache<SquareValues, 8> cache([&](const int &key) {
+        loads++;
+        return static_cast<long long>(key) * key;
+    });
+
+    std::vector<std::thread> threads;
+    std::atomic<int> errors(0);
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, &errors]() {
+            for (int i = 0; i < 2000; i++) {
+                int key = i % 100;
+                if (cache.getAsync(key).get() != static_cast<long long>(key) * key) {
+                    errors++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, errors.load());
+    // Every key was loaded once: it is either in the cache or in flight.
+    EXPECT_EQ(100, loads.load());
+}
+
+TEST(AsyncCacheTest, FullQueue) {
+    std::atomic<bool> release(false);
+    // A single shard and a single thread: the loads leave the same flights while getAsync waits for the queue.
+    AsyncCache<Cache<int, int, 1>, 1> cache(
+        [&](const int &key) {
+            while (!release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return key * 2;
+        },
+        1, 1);
+
+    std::thread releaser([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        release = true;
+    });
+    std::vector<std::shared_future<int>> results;
+    for (int i = 0; i < 5; i++) {
+        results.push_back(cache.getAsync(i));
+    }
+    releaser.join();
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(i * 2, results[i].get());
+    }
+    EXPECT_EQ(0, cache.getPendingCount());
+}
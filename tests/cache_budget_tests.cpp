@@ -0,0 +1,83 @@
+#include "cache_budget.h"
+#include "sharded_cache.h"
+#include "gtest/gtest.h"
+
+using namespace galib;
+
+typedef Cache<int, long long, 1> NumberCache;
+
+static const size_t nodeSize = sizeof(NumberCache::KeyValue);
+
+TEST(CacheBudgetTest, SplitAndRebalance) {
+    NumberCache hot;
+    NumberCache cold;
+    CacheBudgetMember<NumberCache> hotMember(hot);
+    CacheBudgetMember<NumberCache> coldMember(cold);
+
+    CacheBudget budget(200 * nodeSize, 0);
+    budget.add(&hotMember);
+    EXPECT_EQ(200 * nodeSize, budget.getShare(&hotMember));
+    budget.add(&coldMember);
+    EXPECT_EQ(100 * nodeSize, budget.getShare(&hotMember));
+    EXPECT_EQ(100 * nodeSize, hot.getMaxTotalMemUsage());
+
+    // hot reuses its 100 values, cold scans new keys and never hits.
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 100; i++) {
+            hot.get(i);
+            cold.get(round * 100 + i);
+        }
+    }
+    EXPECT_EQ(100, hot.getTotalCount());
+    EXPECT_EQ(100, cold.getTotalCount());
+
+    // The budget moves halfway to the cache with the hits each time.
+    budget.rebalance();
+    EXPECT_EQ(150 * nodeSize, budget.getShare(&hotMember));
+    EXPECT_EQ(50 * nodeSize, budget.getShare(&coldMember));
+    EXPECT_EQ(50, cold.getTotalCount());
+    EXPECT_LE(budget.getTotalMemUsage(), budget.getMaxMemUsage());
+
+    // Without new hits the budget goes back to an even split.
+    budget.rebalance();
+    EXPECT_EQ(125 * nodeSize, budget.getShare(&hotMember));
+
+    budget.configure(100 * nodeSize);
+    EXPECT_EQ(62, hot.getMaxTotalMemUsage() / nodeSize);
+    EXPECT_LE(budget.getTotalMemUsage(), budget.getMaxMemUsage());
+
+    budget.remove(&coldMember);
+    EXPECT_EQ(0, budget.getShare(&coldMember));
+    EXPECT_EQ(100 * nodeSize, budget.getShare(&hotMember));
+}
+
+TEST(CacheBudgetTest, MinShare) {
+    NumberCache hot;
+    NumberCache idle;
+    CacheBudgetMember<NumberCache> hotMember(hot);
+    CacheBudgetMember<NumberCache> idleMember(idle);
+
+    // The idle cache keeps at least half of an even split.
+    CacheBudget budget(200 * nodeSize, 50);
+    budget.add(&hotMember);
+    budget.add(&idleMember);
+    for (int round = 0; round < 20; round++) {
+        hot.get(1);
+        budget.rebalance();
+    }
+    EXPECT_LE(50 * nodeSize, budget.getShare(&idleMember));
+    EXPECT_GT(55 * nodeSize, budget.getShare(&idleMember));
+}
+
+TEST(CacheBudgetTest, ShardedMember) {
+    ShardedCache<NumberCache, 4> cache;
+    CacheBudgetMember<ShardedCache<NumberCache, 4>> member(cache);
+    for (int i = 0; i < 1000; i++) {
+        cache.get(i);
+    }
+
+    CacheBudget budget(400 * nodeSize);
+    budget.add(&member);
+    EXPECT_GE(400 * nodeSize, cache.getTotalMemUsage());
+    EXPECT_LT(300 * nodeSize, cache.getTotalMemUsage());
+}
@@ -0,0 +1,52 @@
+#include "cache.h"
+#include "cache_compression.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace galib;
+
+class TextCache : public Cache<std::string, std::string, 3> {
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int) override {
+        KeyValue *kv = new KeyValue;
+        for (int i = 0; i < 50; i++) {
+            kv->data += "line " + std::to_string(i) + " of " + key + "\n";
+        }
+        return kv;
+    }
+
+    size_t estimateMemSize(KeyValue *kv) override { return sizeof(KeyValue) + kv->data.capacity(); }
+};
+
+TEST(CacheCompressionTest, CompressedMiddleLevel) {
+    CacheCompressedStore<std::string> compressed;
+    TextCache cache;
+    cache.configureLevel(0, 2, 999999);
+    cache.configureLevel(1, 3, 999999);
+    cache.configureLevelStore(1, &compressed);
+
+    for (const char *key : {"a", "b", "c", "d", "e", "f"}) {
+        cache.get(key);
+    }
+    // Level 0: f e, level 1 (compressed): d c b, level 2: a
+    EXPECT_EQ(3, cache.getCount(1));
+    EXPECT_EQ(1, cache.getCount(2));
+    EXPECT_LT(compressed.getCompressedSize() * 2, compressed.getOriginalSize());
+    // The memory usage of the level counts the compressed values.
+    EXPECT_LT(cache.getMemUsage(1), cache.getMemUsage(0));
+
+    // Demoted from the compressed level: decompressed again.
+    std::string a = cache.find("a");
+    EXPECT_EQ(0u, a.find("line 0 of a\n"));
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+
+    std::string c = cache.get("c");
+    EXPECT_EQ(0u, c.find("line 0 of c\n"));
+    EXPECT_EQ(0, cache.touch("c")->_level);
+    EXPECT_EQ(3, cache.getCount(1));
+
+    cache.clear();
+    EXPECT_EQ(0u, compressed.getCompressedSize());
+    EXPECT_EQ(0u, compressed.getOriginalSize());
+}
@@ -0,0 +1,245 @@
+#include "cache.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <vector>
+
+using namespace galib;
+
+template <typename TPolicy> class PolicyCache : public Cache<std::string, std::string, 1, InlineCacheValue, TPolicy> {
+  public:
+    typedef typename Cache<std::string, std::string, 1, InlineCacheValue, TPolicy>::KeyValue KeyValue;
+
+    std::vector<std::string> evicted;
+
+  protected:
+    void onEvict(KeyValue *kv) override { evicted.push_back(kv->_key); }
+};
+
+template <typename TCache> void scan(TCache &cache, const std::string &prefix, int count) {
+    for (int i = 0; i < count; i++) {
+        cache.get(prefix + std::to_string(i));
+    }
+}
+
+TEST(CachePolicyTest, LruScanFlushes) {
+    PolicyCache<LruPolicy> cache;
+    cache.configureLevel(0, 4, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "a", "b"}) {
+        cache.get(key);
+    }
+    scan(cache, "x", 4);
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(4, cache.getTotalCount());
+}
+
+TEST(CachePolicyTest, Slru) {
+    PolicyCache<SlruPolicy<50>> cache;
+    cache.configureLevel(0, 4, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "a", "b"}) {
+        cache.get(key);
+    }
+    // a and b are protected, the scan only replaces the probationary values.
+    scan(cache, "x", 10);
+    EXPECT_EQ(std::vector<std::string>({"c", "d", "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7"}), cache.evicted);
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+
+    // The protected segment holds at most 2 values: when c is protected, a goes back to probation and is replaced.
+    cache.get("c");
+    cache.get("c");
+    scan(cache, "y", 2);
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+    EXPECT_NE(nullptr, cache.findPtr("c"));
+}
+
+TEST(CachePolicyTest, SlruPinnedVictim) {
+    PolicyCache<SlruPolicy<100>> cache;
+    cache.configureLevel(0, 2, 99999);
+    for (const char *key : {"a", "a", "b", "b"}) {
+        cache.get(key);
+    }
+    // a is the protected victim, pinned: it is skipped and stays protected, b is replaced.
+    PolicyCache<SlruPolicy<100>>::Handle handle = cache.getHandle("a");
+    cache.get("b");
+    cache.get("c");
+    EXPECT_EQ(std::vector<std::string>({"b"}), cache.evicted);
+    handle.reset();
+
+    // The probationary values are replaced before a.
+    scan(cache, "x", 3);
+    EXPECT_EQ(std::vector<std::string>({"b", "c", "x0", "x1"}), cache.evicted);
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+}
+
+TEST(CachePolicyTest, TwoQ) {
+    PolicyCache<TwoQPolicy<25, 50>> cache;
+    cache.configureLevel(0, 4, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "e"}) {
+        cache.get(key);
+    }
+    EXPECT_EQ(std::vector<std::string>({"a"}), cache.evicted);
+
+    // a is remembered by the ghost list: it comes back into the main list and survives the scan.
+    cache.get("a");
+    scan(cache, "x", 10);
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(4, cache.getTotalCount());
+
+    // Hits in the fifo are ignored.
+    cache.get("x9");
+    cache.get("x9");
+    scan(cache, "y", 3);
+    EXPECT_EQ(nullptr, cache.findPtr("x9"));
+}
+
+TEST(CachePolicyTest, Arc) {
+    PolicyCache<ArcPolicy> cache;
+    cache.configureLevel(0, 4, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "a", "b"}) {
+        cache.get(key);
+    }
+    scan(cache, "x", 10);
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+    EXPECT_EQ(4, cache.getTotalCount());
+}
+
+struct PolicyNode {
+    Link<PolicyNode> _listLink;
+    unsigned char _segment = 0;
+    size_t _hash = 0;
+};
+
+TEST(CachePolicyTest, ArcAdaptsTarget) {
+    ArcPolicy::Level<PolicyNode> level;
+    level.configure(4);
+    std::vector<PolicyNode> nodes(8);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]._hash = i;
+    }
+
+    // 0..3 are accessed once, 0 leaves T1 and is remembered by B1.
+    for (int i = 0; i < 4; i++) {
+        level.insert(&nodes[i], false);
+    }
+    EXPECT_EQ(&nodes[0], level.victim());
+    level.remove(&nodes[0], true);
+    EXPECT_EQ(0, level.target());
+
+    // 0 comes back: recency matters, T1 may grow.
+    level.insert(&nodes[0], false);
+    EXPECT_EQ(1, level.target());
+    EXPECT_EQ(&nodes[1], level.victim());
+    EXPECT_EQ(&nodes[2], level.victim(&nodes[1]));
+
+    // 0 is in T2 now, and leaves it into B2. When it comes back the target shrinks.
+    level.remove(&nodes[0], true);
+    level.insert(&nodes[0], false);
+    EXPECT_EQ(0, level.target());
+
+    for (int i = 0; i < 4; i++) {
+        level.remove(&nodes[i], false);
+    }
+    EXPECT_EQ(nullptr, level.victim());
+}
+
+TEST(CachePolicyTest, Clock) {
+    PolicyCache<ClockPolicy> cache;
+    cache.configureLevel(0, 4, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "a", "b"}) {
+        cache.get(key);
+    }
+    // a and b were referenced: they get a second chance, c and d are replaced.
+    scan(cache, "x", 2);
+    EXPECT_EQ(std::vector<std::string>({"c", "d"}), cache.evicted);
+
+    // x0 was inserted before the hand moved a and b behind it. Their bits were cleared: a is replaced next, b is
+    // referenced again.
+    cache.get("b");
+    scan(cache, "y", 2);
+    EXPECT_EQ(std::vector<std::string>({"c", "d", "x0", "a"}), cache.evicted);
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+}
+
+TEST(CachePolicyTest, TwoQRequeue) {
+    TwoQPolicy<25, 50>::Level<PolicyNode> level;
+    level.configure(4);
+    std::vector<PolicyNode> nodes(3);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]._hash = i;
+    }
+    // nodes[0] comes back from the ghost list into Am.
+    level.insert(&nodes[0], false);
+    level.remove(&nodes[0], true);
+    level.insert(&nodes[0], false);
+    level.insert(&nodes[1], false);
+    level.insert(&nodes[2], false);
+    EXPECT_EQ(&nodes[1], level.victim());
+
+    // Requeued, nodes[1] stays in A1in: it is still the next victim of the fifo, not of Am.
+    level.requeue(&nodes[1]);
+    EXPECT_EQ(&nodes[2], level.victim());
+    level.requeue(&nodes[2]);
+    EXPECT_EQ(&nodes[1], level.victim());
+    level.remove(&nodes[1], false);
+    level.remove(&nodes[2], false);
+    EXPECT_EQ(&nodes[0], level.victim());
+}
+
+TEST(CachePolicyTest, ClockKeep) {
+    ClockPolicy::Level<PolicyNode> level;
+    std::vector<PolicyNode> nodes(2);
+    level.insert(&nodes[0], false);
+    EXPECT_EQ(nullptr, level.victim(&nodes[0]));
+
+    level.insert(&nodes[1], false);
+    level.touch(&nodes[1]);
+    EXPECT_EQ(&nodes[1], level.victim(&nodes[0]));
+    // All the values were referenced: the hand goes around once.
+    level.touch(&nodes[0]);
+    level.touch(&nodes[1]);
+    EXPECT_EQ(&nodes[1], level.victim());
+}
+
+TEST(CachePolicyTest, ClockPeekVictim) {
+    ClockPolicy::Level<PolicyNode> level;
+    std::vector<PolicyNode> nodes(3);
+    for (PolicyNode &node : nodes) {
+        level.insert(&node, false);
+    }
+    level.touch(&nodes[0]);
+
+    // The hand does not move: nodes[0] keeps its bit.
+    EXPECT_EQ(&nodes[1], level.peekVictim());
+    EXPECT_EQ(&nodes[1], level.peekVictim());
+    level.remove(&nodes[1], false);
+    level.remove(&nodes[2], false);
+    level.insert(&nodes[1], false);
+    EXPECT_EQ(&nodes[1], level.peekVictim());
+    EXPECT_EQ(&nodes[1], level.victim());
+}
+
+TEST(CachePolicyTest, GhostListDuplicate) {
+    detail::CacheGhostList ghosts;
+    ghosts.configure(2);
+    ghosts.add(1);
+    ghosts.add(1);
+    EXPECT_EQ(1u, ghosts.size());
+
+    // The duplicate moved 1 to the head: 2 is the oldest ghost.
+    ghosts.add(2);
+    ghosts.add(1);
+    ghosts.add(3);
+    EXPECT_EQ(2u, ghosts.size());
+    EXPECT_FALSE(ghosts.remove(2));
+    EXPECT_TRUE(ghosts.remove(1));
+    EXPECT_FALSE(ghosts.remove(1));
+    EXPECT_TRUE(ghosts.remove(3));
+    EXPECT_EQ(0u, ghosts.size());
+}
@@ -0,0 +1,94 @@
+#include "cache.h"
+#include "cache_snapshot.h"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace galib;
+
+class SnapshotCache : public Cache<std::string, std::string, 2> {
+  public:
+    std::uint64_t now = 1000;
+
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int) override {
+        KeyValue *kv = new KeyValue;
+        kv->data = "value of " + key;
+        return kv;
+    }
+
+    std::uint64_t currentTime() const override { return now; }
+};
+
+static std::string snapshotPath() { return "/tmp/CacheSnapshot_954353.bin"; }
+
+TEST(CacheSnapshotTest, SaveLoad) {
+    SnapshotCache cache;
+    cache.configureLevel(0, 2, 99999);
+    for (const char *key : {"a", "b", "c", "d"}) {
+        cache.get(key);
+    }
+    cache.get("e", -1, 50);
+    cache.get("f", -1, 10);
+    cache.now += 10;
+    // Level 0: e (f expired), level 1: d c b a
+    ASSERT_TRUE(saveSnapshot(cache, snapshotPath()));
+
+    SnapshotCache loaded;
+    loaded.now = 5000;
+    loaded.configureLevel(0, 2, 99999);
+    loaded.get("stale");
+    ASSERT_TRUE(loadSnapshot(loaded, snapshotPath()));
+    std::remove(snapshotPath().c_str());
+
+    EXPECT_EQ(nullptr, loaded.findPtr("stale"));
+    EXPECT_EQ(nullptr, loaded.findPtr("f"));
+    EXPECT_EQ(1, loaded.getCount(0));
+    EXPECT_EQ(4, loaded.getCount(1));
+    EXPECT_EQ("value of a", loaded.find("a"));
+    EXPECT_EQ(5 * sizeof(SnapshotCache::KeyValue), loaded.getTotalMemUsage());
+
+    // The order is restored: a is the least recently used value of level 1.
+    loaded.configureLevel(1, 3, 99999);
+    loaded.get("g");
+    EXPECT_EQ(nullptr, loaded.findPtr("a"));
+    EXPECT_NE(nullptr, loaded.findPtr("b"));
+
+    // The remaining time to live is restored.
+    EXPECT_EQ(1, loaded.expire(5000 + 40));
+    EXPECT_EQ(nullptr, loaded.findPtr("e"));
+}
+
+TEST(CacheSnapshotTest, InvalidSnapshot) {
+    SnapshotCache cache;
+    cache.get("a");
+    std::string bytes;
+    PodCacheSerializer serializer;
+    cache.serialize(bytes, serializer);
+
+    SnapshotCache loaded;
+    loaded.get("kept");
+    EXPECT_FALSE(loaded.deserialize(bytes.data(), bytes.size() - 1, serializer));
+    EXPECT_FALSE(loaded.deserialize("GCS0", 4, serializer));
+    EXPECT_FALSE(loadSnapshot(loaded, snapshotPath() + ".missing"));
+    // The same key twice.
+    std::string duplicated = bytes + bytes.substr(4);
+    EXPECT_FALSE(loaded.deserialize(duplicated.data(), duplicated.size(), serializer));
+    EXPECT_NE(nullptr, loaded.findPtr("kept"));
+    EXPECT_EQ(1, loaded.getTotalCount());
+
+    EXPECT_TRUE(loaded.deserialize(bytes.data(), bytes.size(), serializer));
+    EXPECT_EQ(nullptr, loaded.findPtr("kept"));
+    EXPECT_EQ("value of a", loaded.find("a"));
+
+    Cache<int, double, 1> numbers;
+    numbers.put(1, 0.5);
+    numbers.put(2, 1.5);
+    bytes.clear();
+    numbers.serialize(bytes, serializer);
+    Cache<int, double, 1> loadedNumbers;
+    EXPECT_TRUE(loadedNumbers.deserialize(bytes.data(), bytes.size(), serializer));
+    EXPECT_EQ(1.5, loadedNumbers.find(2));
+    EXPECT_EQ(2, loadedNumbers.getTotalCount());
+}
@@ -0,0 +1,77 @@
+#include "cache.h"
+#include "cache_spill.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+using namespace galib;
+
+class SpillCache : public Cache<std::string, std::string, 2> {
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int) override {
+        KeyValue *kv = new KeyValue;
+        kv->data = "value of " + key;
+        return kv;
+    }
+
+    void onCacheLevelChanged(KeyValue *kv, int, int) override {
+        // The value is in memory when it enters or leaves the spill level.
+        EXPECT_EQ("value of " + kv->_key, kv->data);
+    }
+};
+
+static std::string spillPath() { return "/tmp/CacheSpill_571266.bin"; }
+
+TEST(CacheSpillTest, DemoteAndPromote) {
+    CacheSpillFile<std::string> spill(spillPath());
+    ASSERT_TRUE(spill.isOpen());
+    SpillCache cache;
+    cache.configureLevel(0, 2, 99999);
+    EXPECT_FALSE(cache.configureLevelStore(0, &spill));
+    EXPECT_TRUE(cache.configureLevelStore(1, &spill));
+
+    for (const char *key : {"a", "b", "c", "d"}) {
+        cache.get(key);
+    }
+    // Level 0: d c, level 1 (in the file): b a
+    EXPECT_EQ(2, cache.getCount(1));
+    EXPECT_EQ(std::string("value of a").size() * 2, spill.getLiveSize());
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_EQ("value of a", cache.find("a"));
+    EXPECT_EQ(2, cache.getCount(1));
+
+    // A hit reads the value back and promotes it to level 0, demoting c.
+    EXPECT_EQ("value of a", cache.get("a"));
+    EXPECT_EQ(0, cache.touch("a")->_level);
+    EXPECT_EQ(nullptr, cache.findPtr("c"));
+    EXPECT_EQ(2, cache.getCount(0));
+    EXPECT_EQ(2, cache.getCount(1));
+    EXPECT_EQ(std::string("value of b").size() * 2, spill.getLiveSize());
+
+    // The new values are never inserted in the spill level.
+    cache.get("e", 1);
+    EXPECT_EQ(0, cache.touch("e")->_level);
+
+    cache.remove("b");
+    cache.clear();
+    EXPECT_EQ(0u, spill.getLiveSize());
+}
+
+TEST(CacheSpillTest, Compaction) {
+    CacheSpillFile<std::string> spill(spillPath(), 1024);
+    SpillCache cache;
+    cache.configureLevel(0, 1, 99999);
+    cache.configureLevel(1, 1000, 999999);
+    cache.configureLevelStore(1, &spill);
+
+    const int count = 100;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < count; i++) {
+            EXPECT_EQ("value of " + std::to_string(i), cache.get(std::to_string(i)));
+        }
+        // Every value read from the file was discarded: the file is rewritten before it grows past twice the values.
+        EXPECT_LE(spill.getFileSize(), 2 * spill.getLiveSize() + 1024);
+    }
+    EXPECT_EQ(count - 1, cache.getCount(1));
+    EXPECT_EQ("value of 7", cache.find("7"));
+}
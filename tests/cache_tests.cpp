@@ -1,5 +1,7 @@
 #include "cache.h"
 #include "gtest/gtest.h"
+#include <chrono>
+#include <vector>
 
 using namespace galib;
 
@@ -55,3 +57,637 @@ TEST(CacheTest, BasicGetRemove) {
     EXPECT_EQ(StringCacheValue("a", 0, -1), cache.get("a"));
     EXPECT_EQ(StringCacheValue("bb", 1, 0), cache.get("b"));
 }
+
+class ThreeLevelStringCache : public Cache<std::string, StringCacheValue, 3> {
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int lvl) override {
+        KeyValue *kv = new KeyValue;
+        kv->data.value = key;
+        kv->data.level = lvl;
+        return kv;
+    }
+
+    void onCacheLevelChanged(KeyValue *kv, int oldLvl, int newLvl) override {
+        kv->data.level = newLvl;
+        kv->data.oldLevel = oldLvl;
+    }
+};
+
+TEST(CacheTest, MultiLevelDemotion) {
+    ThreeLevelStringCache cache;
+    cache.configureLevel(0, 1, 99999);
+    cache.configureLevel(1, 1, 99999);
+
+    cache.get("a");
+    cache.get("b");
+    cache.get("c");
+    // a was demoted twice, b once.
+    EXPECT_EQ(StringCacheValue("a", 2, 1), cache.find("a"));
+    EXPECT_EQ(StringCacheValue("b", 1, 0), cache.find("b"));
+    EXPECT_EQ(StringCacheValue("c", 0, -1), cache.find("c"));
+    EXPECT_EQ(1, cache.getCount(0));
+    EXPECT_EQ(1, cache.getCount(1));
+    EXPECT_EQ(1, cache.getCount(2));
+
+    // Explicitly moving a to level 0 pushes c down, which pushes b down.
+    EXPECT_EQ(StringCacheValue("a", 0, 2), cache.get("a", 0));
+    EXPECT_EQ(StringCacheValue("c", 1, 0), cache.find("c"));
+    EXPECT_EQ(StringCacheValue("b", 2, 1), cache.find("b"));
+
+    cache.remove("b");
+    EXPECT_EQ(nullptr, cache.findPtr("b"));
+    EXPECT_EQ(0, cache.getCount(2));
+    EXPECT_EQ(2, cache.getTotalCount());
+}
+
+class EvictingStringCache : public StringCache {
+  public:
+    std::vector<std::string> evicted;
+
+  protected:
+    void onEvict(KeyValue *kv) override { evicted.push_back(kv->_key); }
+};
+
+TEST(CacheTest, EvictFromLastLevel) {
+    EvictingStringCache cache;
+    cache.configureLevel(0, 1, 99999);
+    cache.configureLevel(1, 2, 99999);
+
+    for (const char *key : {"a", "b", "c", "d", "e"}) {
+        cache.get(key);
+    }
+
+    // e is in level 0, d and c in level 1, a and b were evicted (least recently used first).
+    EXPECT_EQ(3, cache.getTotalCount());
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), cache.evicted);
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(StringCacheValue("c", 1, 0), cache.find("c"));
+
+    // Removing is not evicting.
+    cache.remove("c");
+    EXPECT_EQ(2, cache.evicted.size());
+}
+
+TEST(CacheTest, DefaultLastLevelKeepsValues) {
+    // Only level 0 is configured: its values are demoted past its limit, the last level keeps them all.
+    EvictingStringCache cache;
+    cache.configureLevel(0, 100, 99999);
+    for (int i = 0; i < 20000; i++) {
+        cache.get(std::to_string(i));
+    }
+    EXPECT_EQ(100, cache.getCount(0));
+    EXPECT_EQ(19900, cache.getCount(1));
+    EXPECT_TRUE(cache.evicted.empty());
+    EXPECT_NE(nullptr, cache.findPtr("0"));
+}
+
+TEST(CacheTest, TotalCapacity) {
+    EvictingStringCache cache;
+    cache.configureLevel(0, 2, 99999);
+    cache.configureCapacity(3, static_cast<size_t>(-1));
+
+    for (const char *key : {"a", "b", "c", "d"}) {
+        cache.get(key);
+    }
+    EXPECT_EQ(3, cache.getTotalCount());
+    EXPECT_EQ(std::vector<std::string>({"a"}), cache.evicted);
+
+    // A value moved explicitly to the last level is never evicted by its own insertion.
+    EXPECT_EQ(StringCacheValue("e", 1, -1), cache.get("e", 1));
+    EXPECT_EQ(3, cache.getTotalCount());
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), cache.evicted);
+}
+
+class SeparateStringCache : public Cache<std::string, StringCacheValue, 2, SeparateCacheValue> {
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int lvl) override {
+        KeyValue *kv = new KeyValue;
+        kv->value().value = key;
+        kv->value().level = lvl;
+        return kv;
+    }
+
+    void onCacheLevelChanged(KeyValue *kv, int oldLvl, int newLvl) override {
+        kv->data->level = newLvl;
+        kv->data->oldLevel = oldLvl;
+    }
+};
+
+TEST(CacheTest, SeparateValueLayout) {
+    SeparateStringCache cache;
+    cache.configureLevel(0, 1, 99999);
+
+    EXPECT_EQ(StringCacheValue("a", 0, -1), cache.get("a"));
+    EXPECT_EQ(StringCacheValue("b", 0, -1), cache.get("b"));
+    EXPECT_EQ(StringCacheValue("a", 1, 0), cache.get("a"));
+
+    cache.getPtr("a")->value = "aa";
+    EXPECT_EQ(StringCacheValue("aa", 1, 0), cache.find("a"));
+
+    cache.remove("a");
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+}
+
+class ExpiringStringCache : public EvictingStringCache {
+  public:
+    std::uint64_t now = 1000;
+    std::vector<std::string> expired;
+
+  protected:
+    std::uint64_t currentTime() const override { return now; }
+    void onExpire(KeyValue *kv) override { expired.push_back(kv->_key); }
+};
+
+TEST(CacheTest, TimeToLive) {
+    ExpiringStringCache cache;
+
+    cache.get("a", -1, 10);
+    cache.get("b", -1, 20);
+    cache.get("c");
+    EXPECT_EQ(3, cache.getTotalCount());
+
+    // An expired value is not returned, even before expire() deleted it.
+    cache.now = 1010;
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+
+    EXPECT_EQ(1, cache.expire(1015));
+    EXPECT_EQ(std::vector<std::string>({"a"}), cache.expired);
+    EXPECT_EQ(2, cache.getTotalCount());
+
+    // A get of an expired value creates a new one.
+    cache.now = 1020;
+    EXPECT_EQ(StringCacheValue("b", 0, -1), cache.get("b", -1, 100));
+    EXPECT_EQ(std::vector<std::string>({"a", "b"}), cache.expired);
+    EXPECT_EQ(0, cache.expire(1100));
+    EXPECT_EQ(1, cache.expire(1120));
+
+    // Values without a ttl never expire and removed values are not expired.
+    cache.get("d", -1, 5);
+    cache.remove("d");
+    EXPECT_EQ(0, cache.expire(100000));
+    EXPECT_NE(nullptr, cache.findPtr("c"));
+    EXPECT_TRUE(cache.evicted.empty());
+}
+
+TEST(CacheTest, ExpireOnGet) {
+    ExpiringStringCache cache;
+    cache.configureExpiration(true);
+
+    for (int i = 0; i < 100; i++) {
+        cache.get(std::to_string(i), -1, 1 + i % 10);
+    }
+    EXPECT_EQ(100, cache.getTotalCount());
+
+    cache.now += 5;
+    cache.get("x");
+    EXPECT_EQ(50, cache.expired.size());
+    EXPECT_EQ(51, cache.getTotalCount());
+}
+
+TEST(CacheTest, FrequencySketch) {
+    FrequencySketch sketch(1000);
+    std::hash<std::string> hasher;
+    for (int i = 0; i < 20; i++) {
+        sketch.increment(hasher("hot"));
+    }
+    sketch.increment(hasher("cold"));
+
+    // The counters saturate at 15 and are halved when aging.
+    EXPECT_EQ(15, sketch.estimate(hasher("hot")));
+    EXPECT_LE(1, sketch.estimate(hasher("cold")));
+    EXPECT_GE(2, sketch.estimate(hasher("cold")));
+    sketch.age();
+    EXPECT_EQ(7, sketch.estimate(hasher("hot")));
+}
+
+TEST(CacheTest, AdmissionResistsScan) {
+    EvictingStringCache cache;
+    cache.configureLevel(0, 4, 99999);
+    cache.configureLevel(1, 4, 99999);
+    cache.configureAdmission(64);
+
+    std::vector<std::string> hot = {"h0", "h1", "h2", "h3", "h4", "h5", "h6", "h7"};
+    for (int round = 0; round < 3; round++) {
+        for (const std::string &key : hot) {
+            cache.get(key);
+        }
+    }
+    EXPECT_TRUE(cache.evicted.empty());
+
+    // A scan of keys accessed once does not flush the frequently used keys.
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ("s" + std::to_string(i), cache.get("s" + std::to_string(i)).value);
+        // The levels plus the admission window of one value.
+        EXPECT_EQ(9, cache.getTotalCount());
+    }
+    EXPECT_EQ(nullptr, cache.findPtr("s98"));
+    EXPECT_NE(nullptr, cache.findPtr("s99"));
+    for (const std::string &key : hot) {
+        EXPECT_NE(nullptr, cache.findPtr(key)) << key;
+    }
+
+    // Without the filter the scan evicts them.
+    cache.configureAdmission(0);
+    for (int i = 0; i < 100; i++) {
+        cache.get("t" + std::to_string(i));
+    }
+    EXPECT_EQ(nullptr, cache.findPtr("h0"));
+}
+
+class LoadCountingStringCache : public EvictingStringCache {
+  public:
+    int loads = 0;
+
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int lvl) override {
+        loads++;
+        return EvictingStringCache::newCacheValue(key, lvl);
+    }
+};
+
+TEST(CacheTest, AdmissionWindow) {
+    LoadCountingStringCache cache;
+    cache.configureLevel(0, 4, 99999);
+    cache.configureLevel(1, 4, 99999);
+    cache.configureAdmission(64);
+    for (int i = 0; i < 9; i++) {
+        cache.get("k" + std::to_string(i));
+    }
+    EXPECT_EQ(9, cache.getTotalCount());
+    EXPECT_EQ(5, cache.getCount(0));
+    EXPECT_TRUE(cache.evicted.empty());
+
+    // A new key accessed twice in a row is loaded once: it waits in the window, then it is more frequent than the
+    // victim of the last level.
+    cache.get("n");
+    cache.get("n");
+    EXPECT_EQ(10, cache.loads);
+    cache.get("x");
+    EXPECT_NE(nullptr, cache.findPtr("n"));
+    EXPECT_EQ(std::vector<std::string>({"k8", "k0"}), cache.evicted);
+    EXPECT_EQ(StringCacheValue("n", 0, -1), cache.get("n"));
+
+    // The window is counted in the statistics of level 0.
+    EXPECT_EQ(11, cache.getStats(0).misses);
+    EXPECT_EQ(5, cache.getStats(0).count);
+}
+
+template <size_t TValueSize> struct BenchmarkValue {
+    char bytes[TValueSize];
+};
+
+template <size_t TValueSize, typename TValueLayout>
+double measureHitLatency(int entries, int lookups) {
+    Cache<int, BenchmarkValue<TValueSize>, 1, TValueLayout> cache;
+    cache.configureLevel(0, entries, static_cast<size_t>(-1));
+    for (int i = 0; i < entries; i++) {
+        cache.getPtr(i)->bytes[0] = static_cast<char>(i);
+    }
+
+    // Visit the keys in a pseudo random order so that the nodes are not already in the CPU cache.
+    int sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        sum += cache.getPtr(static_cast<int>((i * 7919LL) % entries))->bytes[0];
+    }
+    auto end = std::chrono::steady_clock::now();
+    EXPECT_NE(-1, sum);
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+}
+
+TEST(CacheTest, DISABLED_HitLatencyBenchmark) {
+    const int entries = 1 << 16;
+    const int lookups = 1 << 22;
+    printf("hit latency [ns]    inline    separate\n");
+    printf("small value (16B)   %6.1f    %6.1f\n", measureHitLatency<16, InlineCacheValue>(entries, lookups),
+           measureHitLatency<16, SeparateCacheValue>(entries, lookups));
+    printf("large value (4KB)   %6.1f    %6.1f\n", measureHitLatency<4096, InlineCacheValue>(entries, lookups),
+           measureHitLatency<4096, SeparateCacheValue>(entries, lookups));
+}
+
+TEST(CacheTest, PutAndTouch) {
+    StringCache cache;
+    cache.configureLevel(0, 1, 99999);
+
+    // touch never creates a value.
+    EXPECT_EQ(nullptr, cache.touch("a"));
+    EXPECT_EQ(0, cache.getTotalCount());
+
+    StringCache::KeyValue *kv = cache.put("a", StringCacheValue("loaded", 0, -1));
+    EXPECT_EQ("a", kv->_key);
+    EXPECT_EQ(StringCacheValue("loaded", 0, -1), cache.find("a"));
+    EXPECT_EQ(kv, cache.touch("a"));
+
+    // put replaces the current value.
+    cache.put("a", StringCacheValue("reloaded", 0, -1));
+    EXPECT_EQ(StringCacheValue("reloaded", 0, -1), cache.get("a"));
+    EXPECT_EQ(1, cache.getTotalCount());
+}
+
+class MissingFileCache : public Cache<std::string, std::string, 1> {
+  public:
+    std::uint64_t now = 1000;
+    int loads = 0;
+
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int) override {
+        loads++;
+        if (key.compare(0, 7, "missing") == 0) {
+            return nullptr;
+        }
+        KeyValue *kv = new KeyValue;
+        kv->data = key;
+        return kv;
+    }
+
+    std::uint64_t currentTime() const override { return now; }
+};
+
+TEST(CacheTest, NegativeCaching) {
+    MissingFileCache cache;
+
+    // Disabled by default.
+    EXPECT_EQ(nullptr, cache.getPtr("missing1"));
+    EXPECT_EQ(nullptr, cache.getPtr("missing1"));
+    EXPECT_EQ(2, cache.loads);
+
+    cache.configureNegativeCaching(2, 100);
+    cache.loads = 0;
+    EXPECT_EQ(nullptr, cache.getPtr("missing1"));
+    EXPECT_EQ(nullptr, cache.getPtr("missing1"));
+    EXPECT_EQ(nullptr, cache.findPtr("missing1"));
+    EXPECT_EQ(1, cache.loads);
+    EXPECT_EQ(1, cache.getNegativeCount());
+    EXPECT_EQ(0, cache.getTotalCount());
+
+    // Own budget: missing1 was used more recently than missing2, missing2 is dropped.
+    cache.getPtr("missing2");
+    cache.getPtr("missing1");
+    cache.getPtr("missing3");
+    EXPECT_EQ(2, cache.getNegativeCount());
+    EXPECT_EQ(3, cache.loads);
+    cache.getPtr("missing1");
+    EXPECT_EQ(3, cache.loads);
+    cache.getPtr("missing2");
+    EXPECT_EQ(4, cache.loads);
+
+    // Expired negative entries are loaded again.
+    cache.now += 100;
+    cache.getPtr("missing1");
+    EXPECT_EQ(5, cache.loads);
+    EXPECT_EQ(1, cache.expire(cache.now));
+    EXPECT_EQ(1, cache.getNegativeCount());
+
+    // A put replaces the negative entry, remove and clear drop them.
+    cache.put("missing1", "created");
+    EXPECT_EQ("created", cache.get("missing1"));
+    EXPECT_EQ(0, cache.getNegativeCount());
+    cache.getPtr("missing4");
+    cache.remove("missing4");
+    EXPECT_EQ(0, cache.getNegativeCount());
+    cache.getPtr("missing5");
+    cache.clear();
+    EXPECT_EQ(0, cache.getNegativeCount());
+    EXPECT_EQ(0, cache.getTotalCount());
+}
+
+TEST(CacheTest, Stats) {
+    EvictingStringCache cache;
+    cache.configureLevel(0, 1, 99999);
+    cache.configureLevel(1, 1, 99999);
+
+    cache.get("a");
+    cache.get("b"); // a is demoted
+    cache.get("a"); // hit in level 1
+    cache.get("a", 0); // promotion, b is demoted
+    cache.get("c"); // a is demoted, b is evicted
+    cache.touch("d");
+
+    CacheLevelStats level0 = cache.getStats(0);
+    CacheLevelStats level1 = cache.getStats(1);
+    EXPECT_EQ(0, level0.hits);
+    EXPECT_EQ(2, level1.hits);
+    EXPECT_EQ(4, level0.misses);
+    EXPECT_EQ(3, level0.inserts);
+    EXPECT_EQ(3, level0.demotions);
+    EXPECT_EQ(1, level1.promotions);
+    EXPECT_EQ(1, level1.evictions);
+    EXPECT_EQ(1, level0.count);
+    EXPECT_EQ(1, level1.count);
+    EXPECT_EQ(cache.getMemUsage(1), level1.memUsage);
+    EXPECT_EQ(0, cache.getStats(2).hits);
+
+    // Latency sampling: disabled by default, then every second getKeyValue.
+    EXPECT_EQ(0, cache.getLatencyHistogram().total());
+    cache.configureLatencySampling(2);
+    for (int i = 0; i < 10; i++) {
+        cache.get("c");
+    }
+    CacheLatencyHistogram latencies = cache.getLatencyHistogram();
+    EXPECT_EQ(5, latencies.total());
+    EXPECT_LT(0, latencies.percentile(50));
+    EXPECT_LE(latencies.percentile(50), latencies.percentile(99));
+}
+
+TEST(CacheTest, HitStatsDisabled) {
+    StringCache cache;
+    cache.configureHitStats(false);
+    const std::string keys[] = {"a", "b"};
+    StringCacheValue out[2];
+    cache.get("a");
+    cache.get("a");
+    cache.getMany(keys, 2, out);
+    EXPECT_EQ(0, cache.getStats(0).hits);
+    EXPECT_EQ(2, cache.getStats(0).misses);
+
+    cache.configureHitStats(true);
+    cache.get("a");
+    EXPECT_EQ(1, cache.getStats(0).hits);
+}
+
+TEST(CacheTest, LatencyHistogramBuckets) {
+    EXPECT_EQ(0, CacheLatencyHistogram::bucketOf(0));
+    EXPECT_EQ(0, CacheLatencyHistogram::bucketOf(1));
+    EXPECT_EQ(1, CacheLatencyHistogram::bucketOf(2));
+    EXPECT_EQ(1, CacheLatencyHistogram::bucketOf(3));
+    EXPECT_EQ(10, CacheLatencyHistogram::bucketOf(1024));
+
+    CacheLatencyHistogram histogram;
+    histogram.buckets[3] = 90;
+    histogram.buckets[10] = 10;
+    EXPECT_EQ(16, histogram.percentile(50));
+    EXPECT_EQ(2048, histogram.percentile(95));
+    EXPECT_EQ(0, CacheLatencyHistogram().percentile(50));
+}
+
+class CountingStringCache : public EvictingStringCache {
+  public:
+    ~CountingStringCache() override { clear(); }
+
+    int deleted = 0;
+
+  protected:
+    void deleteCacheValue(KeyValue *kv) override {
+        deleted++;
+        delete kv;
+    }
+};
+
+TEST(CacheTest, PinnedHandles) {
+    CountingStringCache cache;
+    cache.configureLevel(0, 1, 99999);
+    cache.configureLevel(1, 1, 99999);
+
+    StringCache::Handle a = cache.getHandle("a");
+    EXPECT_TRUE(static_cast<bool>(a));
+    EXPECT_EQ("a", a->value);
+    EXPECT_EQ("a", a.key());
+    EXPECT_FALSE(static_cast<bool>(cache.findHandle("x")));
+
+    // a is pinned in level 0: the other values are demoted and evicted instead, even if level 0 stays over capacity.
+    cache.get("b");
+    cache.get("c");
+    cache.get("d");
+    EXPECT_EQ(0, (*a).level);
+    EXPECT_EQ(2, cache.getCount(0));
+    EXPECT_NE(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(std::vector<std::string>({"b"}), cache.evicted);
+
+    // A removed pinned value stays readable until the last handle is released.
+    StringCache::Handle copy = a;
+    cache.remove("a");
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(1, cache.getZombieCount());
+    EXPECT_EQ("a", copy->value);
+    a.reset();
+    cache.sweepZombies();
+    EXPECT_EQ(1, cache.getZombieCount());
+    StringCache::Handle moved = std::move(copy);
+    EXPECT_FALSE(static_cast<bool>(copy));
+    moved = StringCache::Handle();
+    int deleted = cache.deleted;
+    cache.get("d");
+    EXPECT_EQ(0, cache.getZombieCount());
+    EXPECT_EQ(std::vector<std::string>({"b"}), cache.evicted);
+    EXPECT_EQ(deleted + 1, cache.deleted);
+}
+
+TEST(CacheTest, GetMany) {
+    EvictingStringCache cache;
+    cache.configureLevel(0, 3, 99999);
+    cache.configureLevel(1, 37, 99999);
+    for (int i = 0; i < 20; i++) {
+        cache.get(std::to_string(i));
+    }
+
+    // Hits, misses and a duplicate, in more than one batch of 16.
+    std::vector<std::string> keys;
+    for (int i = 15; i < 40; i++) {
+        keys.push_back(std::to_string(i));
+    }
+    keys.push_back("3");
+    keys.push_back("30");
+    std::vector<StringCacheValue> values(keys.size());
+    // 15..19, 3 and the second 30 are found.
+    EXPECT_EQ(7, cache.getMany(keys.data(), keys.size(), values.data()));
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(keys[i], values[i].value);
+    }
+    EXPECT_EQ(40, cache.getTotalCount());
+    EXPECT_TRUE(cache.evicted.empty());
+
+    // The hits are relinked: 0 (not in the batch) is the next value evicted.
+    cache.get("new");
+    EXPECT_EQ(std::vector<std::string>({"0"}), cache.evicted);
+
+    // An explicit level moves the values.
+    std::string moved[] = {"1", "2"};
+    StringCacheValue movedValues[2];
+    EXPECT_EQ(2, cache.getMany(moved, 2, movedValues, 0));
+    EXPECT_EQ(0, movedValues[1].level);
+    EXPECT_EQ(0, cache.find("1").level);
+}
+
+TEST(CacheTest, InvalidateTag) {
+    StringCache cache;
+    cache.configureLevel(0, 2, 99999);
+    for (const char *key : {"a", "b", "c", "d", "e"}) {
+        cache.get(key);
+    }
+    EXPECT_TRUE(cache.setTag("a", "tenant1"));
+    EXPECT_TRUE(cache.setTag("c", "tenant1"));
+    EXPECT_TRUE(cache.setTag("e", "tenant1"));
+    EXPECT_TRUE(cache.setTag("d", "tenant2"));
+    EXPECT_FALSE(cache.setTag("missing", "tenant1"));
+    // A value has a single tag.
+    EXPECT_TRUE(cache.setTag("e", "tenant2"));
+
+    EXPECT_EQ(2, cache.invalidateTag("tenant1"));
+    EXPECT_EQ(nullptr, cache.findPtr("a"));
+    EXPECT_EQ(nullptr, cache.findPtr("c"));
+    EXPECT_EQ(3, cache.getTotalCount());
+    EXPECT_EQ(0, cache.invalidateTag("tenant1"));
+
+    // Removed values leave their tag.
+    cache.remove("d");
+    EXPECT_EQ(1, cache.invalidateTag("tenant2"));
+    EXPECT_EQ(1, cache.getTotalCount());
+    EXPECT_NE(nullptr, cache.findPtr("b"));
+}
+
+TEST(CacheTest, InvalidatePrefix) {
+    StringCache cache;
+    cache.configureLevel(0, 2, 99999);
+    const char *keys[] = {"/a/x", "/a/y", "/a/b/x", "/a/bc/x", "/ab/x", "/b/x", "top"};
+    for (const char *key : keys) {
+        cache.get(key);
+    }
+
+    // Without the index, all the values are visited.
+    EXPECT_EQ(1, cache.invalidatePrefix("/b/"));
+    cache.get("/b/x");
+
+    cache.configurePrefixIndex('/');
+    EXPECT_EQ(2, cache.invalidatePrefix("/a/b"));
+    EXPECT_EQ(nullptr, cache.findPtr("/a/b/x"));
+    EXPECT_EQ(nullptr, cache.findPtr("/a/bc/x"));
+    EXPECT_NE(nullptr, cache.findPtr("/ab/x"));
+
+    // The new values are indexed too.
+    cache.get("/a/b/z");
+    EXPECT_EQ(4, cache.invalidatePrefix("/a"));
+    EXPECT_EQ(nullptr, cache.findPtr("/ab/x"));
+    EXPECT_EQ(2, cache.getTotalCount());
+
+    EXPECT_EQ(0, cache.invalidatePrefix("/c/"));
+    EXPECT_EQ(2, cache.invalidatePrefix(""));
+    EXPECT_EQ(0, cache.getTotalCount());
+}
+
+TEST(CacheTest, InvalidateNegatives) {
+    MissingFileCache cache;
+    cache.configureNegativeCaching(100, 0);
+    cache.configurePrefixIndex('/');
+    cache.getPtr("missing/a/x");
+    cache.getPtr("missing/a/y");
+    cache.getPtr("found/a/x");
+    EXPECT_EQ(2, cache.getNegativeCount());
+
+    // The negative entries are indexed, and tagged like the values.
+    EXPECT_TRUE(cache.setTag("missing/a/y", "source"));
+    EXPECT_EQ(1, cache.invalidateTag("source"));
+    EXPECT_EQ(1, cache.getNegativeCount());
+    EXPECT_EQ(1, cache.invalidatePrefix("missing/a/"));
+    EXPECT_EQ(0, cache.getNegativeCount());
+    EXPECT_EQ(1, cache.getTotalCount());
+    EXPECT_EQ(nullptr, cache.findPtr("missing/a/x"));
+    cache.getPtr("missing/a/x");
+    EXPECT_EQ(4, cache.loads);
+
+    // Without the index, the negative entries are scanned.
+    cache.configurePrefixIndex(0);
+    EXPECT_EQ(1, cache.invalidatePrefix("missing/"));
+    EXPECT_EQ(0, cache.getNegativeCount());
+}
@@ -0,0 +1,94 @@
+#include "cache.h"
+#include "cache_trace.h"
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace galib;
+
+class TracedCache : public Cache<std::string, std::string, 2> {
+  protected:
+    KeyValue *newCacheValue(const std::string &key, int) override {
+        if (key == "missing") {
+            return nullptr;
+        }
+        KeyValue *kv = new KeyValue;
+        kv->data = "value of " + key;
+        return kv;
+    }
+
+    size_t estimateMemSize(KeyValue *kv) override { return 100 + kv->data.size(); }
+};
+
+static std::string tracePath() { return "/tmp/CacheTrace_318805.bin"; }
+
+TEST(CacheTraceTest, RecordSaveLoad) {
+    CacheTrace trace;
+    TracedCache cache;
+    cache.configureTrace(&trace);
+    cache.get("a");
+    cache.get("missing");
+    cache.touch("b");
+    cache.put("b", "12345");
+    cache.remove("a");
+    cache.find("b");
+    cache.configureTrace(nullptr);
+    cache.get("c");
+    EXPECT_EQ(5u, trace.size());
+
+    ASSERT_TRUE(trace.save(tracePath()));
+    CacheTrace loaded;
+    ASSERT_TRUE(loaded.load(tracePath()));
+    std::remove(tracePath().c_str());
+    EXPECT_EQ(5u, loaded.size());
+
+    std::vector<CacheTrace::Record> records;
+    loaded.forEach([&](const CacheTrace::Record &record) { records.push_back(record); });
+    ASSERT_EQ(5u, records.size());
+    std::hash<std::string> hasher;
+    EXPECT_EQ(CacheTraceOp::get, records[0].op);
+    EXPECT_EQ(hasher("a"), records[0].hash);
+    EXPECT_EQ(110u, records[0].memSize);
+    EXPECT_EQ(0u, records[1].memSize);
+    EXPECT_EQ(CacheTraceOp::touch, records[2].op);
+    EXPECT_EQ(0u, records[2].memSize);
+    EXPECT_EQ(CacheTraceOp::put, records[3].op);
+    EXPECT_EQ(105u, records[3].memSize);
+    EXPECT_EQ(CacheTraceOp::remove, records[4].op);
+    EXPECT_EQ(hasher("a"), records[4].hash);
+
+    EXPECT_FALSE(loaded.load("/tmp/CacheTrace_missing.bin"));
+    EXPECT_EQ(5u, loaded.size());
+}
+
+TEST(CacheTraceTest, Replay) {
+    // A loop over 6 keys: LRU with 4 values never hits, but the hits are back with 6 values.
+    CacheTrace trace;
+    for (int round = 0; round < 10; round++) {
+        for (size_t key = 1; key <= 6; key++) {
+            trace.record(CacheTraceOp::get, key, 10);
+        }
+    }
+
+    ReplayCache<1> small;
+    small.configureLevel(0, 4, 99999);
+    CacheReplayResult result = replayTrace(trace, small);
+    EXPECT_EQ(60u, result.operations);
+    EXPECT_EQ(0u, result.hits);
+    EXPECT_EQ(40u, result.peakMemUsage);
+
+    ReplayCache<2> large;
+    large.configureLevel(0, 4, 99999);
+    large.configureLevel(1, 2, 99999);
+    result = replayTrace(trace, large);
+    EXPECT_EQ(54u, result.hits);
+    EXPECT_EQ(6u, result.misses);
+    EXPECT_EQ(0.9, result.hitRatio());
+    EXPECT_EQ(2u, result.levels.size());
+    // The hits stay in their level: 4 keys in level 0, 2 in level 1.
+    EXPECT_EQ(36u, result.levels[0].hits);
+    EXPECT_EQ(18u, result.levels[1].hits);
+    EXPECT_EQ(60u, result.peakMemUsage);
+}
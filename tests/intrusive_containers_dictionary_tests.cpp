@@ -122,3 +122,84 @@ TEST(IntrusivedictionaryTest, EmptyIterator) {
     delete p1;
     delete p2;
 }
+
+TEST(IntrusivedictionaryTest, BulkLoad) {
+    std::vector<DictLink1 *> items;
+    for (int i = 0; i < 10 * N; i++) {
+        items.push_back(new DictLink1("generated_id_" + std::to_string(i)));
+    }
+
+    Dictionary<DictLink1, std::string, &DictLink1::key, &DictLink1::m_DictLink1> dict;
+    EXPECT_EQ(items.size(), dict.bulkLoad(items.begin(), items.end(), true));
+    for (DictLink1 *item : items) {
+        EXPECT_EQ(item, dict.get(item->key));
+    }
+
+    // Duplicates (in the range and in the dictionary) are skipped unless the keys are declared unique.
+    DictLink1 *duplicate1 = new DictLink1("generated_id_0");
+    DictLink1 *duplicate2 = new DictLink1("new_id");
+    DictLink1 *duplicate3 = new DictLink1("new_id");
+    std::vector<DictLink1 *> more{duplicate1, duplicate2, duplicate3};
+    EXPECT_EQ(1, dict.bulkLoad(more.begin(), more.end()));
+    EXPECT_EQ(items[0], dict.get("generated_id_0"));
+    EXPECT_EQ(duplicate2, dict.get("new_id"));
+    EXPECT_FALSE(duplicate1->m_DictLink1.isLinked());
+    EXPECT_FALSE(duplicate3->m_DictLink1.isLinked());
+
+    dict.deleteAll();
+    delete duplicate1;
+    delete duplicate3;
+    EXPECT_TRUE(dict.isEmpty());
+}
+
+TEST(IntrusivedictionaryTest, Rehash) {
+    Dictionary<DictLink1, std::string, &DictLink1::key, &DictLink1::m_DictLink1> dict(16);
+    for (int i = 0; i < 4 * N; i++) {
+        dict.put(new DictLink1("generated_id_" + std::to_string(i)));
+    }
+
+    dict.rehash(8 * N);
+    for (int i = 0; i < 4 * N; i++) {
+        DictLink1 *item = dict.get("generated_id_" + std::to_string(i));
+        ASSERT_NE(nullptr, item);
+        EXPECT_EQ("generated_id_" + std::to_string(i), item->key);
+    }
+
+    dict.deleteAll();
+}
+
+TEST(IntrusivedictionaryTest, SmallMode) {
+    using SmallDict = Dictionary<DictLink1, std::string, &DictLink1::key, &DictLink1::m_DictLink1,
+                                 std::hash<std::string>, std::equal_to<std::string>, 4>;
+    std::vector<DictLink1 *> items;
+    for (int i = 0; i < 2 * N; i++) {
+        items.push_back(new DictLink1("generated_id_" + std::to_string(i)));
+    }
+
+    SmallDict dict;
+    EXPECT_EQ(1, dict.bucketCount());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(dict.put(items[i]));
+    }
+    EXPECT_EQ(1, dict.bucketCount());
+    EXPECT_FALSE(dict.put(items[0]));
+
+    // Values that unlink themselves do not count towards the threshold.
+    delete items[3];
+    items[3] = new DictLink1("generated_id_3");
+    EXPECT_TRUE(dict.put(items[3]));
+    EXPECT_EQ(1, dict.bucketCount());
+
+    // Past the threshold the values are moved to a bucket array, which grows with the values.
+    for (int i = 4; i < 2 * N; i++) {
+        EXPECT_TRUE(dict.put(items[i]));
+    }
+    EXPECT_LT(1, dict.bucketCount());
+    EXPECT_LE(2 * N, dict.bucketCount());
+    for (DictLink1 *item : items) {
+        EXPECT_EQ(item, dict.get(item->key));
+    }
+
+    dict.deleteAll();
+    EXPECT_TRUE(dict.isEmpty());
+}
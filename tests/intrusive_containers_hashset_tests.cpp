@@ -21,11 +21,23 @@ class Link2 : public SetLink1 {
     Link<Link2> m_link2;
 };
 
+struct SetLink1Hash {
+    size_t operator()(const SetLink1 &v) const { return std::hash<std::string>()(v.data); }
+};
+
+struct SetLink1Equal {
+    bool operator()(const SetLink1 &a, const SetLink1 &b) const { return a.data == b.data; }
+};
+
+using SetLink1HashSet = HashSet<SetLink1, &SetLink1::m_SetLink1, SetLink1Hash, SetLink1Equal>;
+
 TEST(IntrusiveHashSetTest, Empty) {
     SetLink1 *p1 = new SetLink1();
+    p1->data = "p1";
     SetLink1 *p2 = new SetLink1();
+    p2->data = "p2";
 
-    HashSet<SetLink1, &SetLink1::m_SetLink1> l1(100);
+    SetLink1HashSet l1(100);
     EXPECT_TRUE(l1.isEmpty());
     EXPECT_FALSE(l1.contains(NULL));
 
@@ -38,3 +50,61 @@ TEST(IntrusiveHashSetTest, Empty) {
     delete p2;
     EXPECT_EQ(true, l1.isEmpty());
 }
+
+TEST(IntrusiveHashSetTest, ContentInterning) {
+    SetLink1HashSet set;
+    SetLink1 *p1 = new SetLink1();
+    p1->data = "value";
+    SetLink1 *p2 = new SetLink1();
+    p2->data = "value";
+    SetLink1 *p3 = new SetLink1();
+    p3->data = "other";
+
+    EXPECT_TRUE(set.put(p1));
+    EXPECT_TRUE(set.put(p3));
+    // p2 has the same content as p1, which is the interned value
+    EXPECT_TRUE(set.contains(p2));
+    EXPECT_FALSE(set.put(p2));
+    EXPECT_EQ(p1, set.find(p2));
+
+    set.remove(p1);
+    EXPECT_FALSE(set.contains(p2));
+    EXPECT_TRUE(set.put(p2));
+    EXPECT_EQ(p2, set.find(p1));
+
+    delete p1;
+    delete p2;
+    delete p3;
+    EXPECT_TRUE(set.isEmpty());
+}
+
+TEST(IntrusiveHashSetTest, GrowAndIterate) {
+    SetLink1HashSet set;
+    size_t initialBuckets = set.bucketCount();
+    for (int i = 0; i < 10 * N; i++) {
+        SetLink1 *p = new SetLink1();
+        p->data = "generated_id_" + std::to_string(i);
+        p->nData = i;
+        EXPECT_TRUE(set.put(p));
+    }
+    EXPECT_LT(initialBuckets, set.bucketCount());
+
+    int count = 0;
+    int sum = 0;
+    for (SetLink1HashSet::iterator it = set.begin(); it != set.end(); it++) {
+        count++;
+        sum += it->nData;
+    }
+    EXPECT_EQ(10 * N, count);
+    EXPECT_EQ((10 * N - 1) * 10 * N / 2, sum);
+
+    SetLink1 probe;
+    for (int i = 0; i < 10 * N; i++) {
+        probe.data = "generated_id_" + std::to_string(i);
+        ASSERT_NE(nullptr, set.find(&probe));
+        EXPECT_EQ(i, set.find(&probe)->nData);
+    }
+
+    set.deleteAll();
+    EXPECT_TRUE(set.isEmpty());
+}
@@ -166,3 +166,93 @@ TEST(IntrusiveTest, STDIterate) {
 
     l1.deleteAll();
 }
+
+static std::string joinData(const List<Link1, &Link1::m_link1> &l) {
+    std::string s;
+    for (List<Link1, &Link1::m_link1>::const_iterator it = l.begin(); it != l.end(); it++) {
+        s += it->data;
+    }
+    return s;
+}
+
+TEST(IntrusiveTest, SortStable) {
+    List<Link1, &Link1::m_link1> l1;
+    l1.sort([](const Link1 &a, const Link1 &b) { return a.nData < b.nData; });
+    EXPECT_TRUE(l1.isEmpty());
+
+    // Sort the letters by their number, equal numbers must keep their order.
+    const char *letters = "abcdefghijklmnopqrstuvwxyz";
+    const int numbers[] = {3, 1, 2, 3, 1, 0, 2, 2, 1, 0, 3, 1, 0, 2, 3, 1, 1, 0, 2, 3, 0, 1, 2, 3, 0, 1};
+    for (int i = 0; i < 26; i++) {
+        Link1 *n = new Link1;
+        n->data = std::string(1, letters[i]);
+        n->nData = numbers[i];
+        l1.insertTail(n);
+    }
+
+    l1.sort([](const Link1 &a, const Link1 &b) { return a.nData < b.nData; });
+    EXPECT_EQ("fjmruybeilpqvzcghnswadkotx", joinData(l1));
+
+    l1.deleteAll();
+}
+
+TEST(IntrusiveTest, SortMany) {
+    List<Link1, &Link1::m_link1> l1;
+    for (int i = 0; i < 10 * N + 3; i++) {
+        Link1 *n = new Link1;
+        n->nData = (i * 7919) % 1009;
+        l1.insertHead(n);
+    }
+
+    l1.sort([](const Link1 &a, const Link1 &b) { return a.nData < b.nData; });
+
+    int count = 0;
+    for (Link1 *n = l1.head(); n != nullptr; n = l1.next(n)) {
+        Link1 *next = l1.next(n);
+        if (next != nullptr) {
+            EXPECT_LE(n->nData, next->nData);
+        }
+        count++;
+    }
+    EXPECT_EQ(10 * N + 3, count);
+
+    l1.deleteAll();
+}
+
+TEST(IntrusiveTest, MergeSpliceSplit) {
+    List<Link1, &Link1::m_link1> l1;
+    List<Link1, &Link1::m_link1> l2;
+
+    const char *data1 = "acegi";
+    const char *data2 = "bdfhjk";
+    for (int i = 0; data1[i] != 0; i++) {
+        Link1 *n = new Link1;
+        n->data = std::string(1, data1[i]);
+        l1.insertTail(n);
+    }
+    for (int i = 0; data2[i] != 0; i++) {
+        Link1 *n = new Link1;
+        n->data = std::string(1, data2[i]);
+        l2.insertTail(n);
+    }
+
+    l1.merge(l2, [](const Link1 &a, const Link1 &b) { return a.data < b.data; });
+    EXPECT_EQ("abcdefghijk", joinData(l1));
+    EXPECT_TRUE(l2.isEmpty());
+
+    Link1 *f = l1.next(l1.next(l1.next(l1.next(l1.next(l1.head())))));
+    EXPECT_EQ("f", f->data);
+    l1.splitAt(f, l2);
+    EXPECT_EQ("abcde", joinData(l1));
+    EXPECT_EQ("fghijk", joinData(l2));
+
+    l2.splice(l2.head(), l1);
+    EXPECT_EQ("abcdefghijk", joinData(l2));
+    EXPECT_TRUE(l1.isEmpty());
+
+    l1.splice(nullptr, l2);
+    EXPECT_EQ("abcdefghijk", joinData(l1));
+    EXPECT_EQ("k", l1.tail()->data);
+
+    l1.deleteAll();
+}
@@ -0,0 +1,86 @@
+#include "intrusive_containers.h"
+#include "gtest/gtest.h"
+
+using namespace galib;
+
+class IndexedItem {
+  public:
+    IndexedItem(int key_, long long expiry_)
+        : key(key_)
+        , expiry(expiry_) {}
+
+    int key;
+    long long expiry;
+
+    Link<IndexedItem> m_dictLink;
+    Link<IndexedItem> m_lruLink;
+    Link<IndexedItem> m_expiryLink;
+};
+
+using ItemDict = Dictionary<IndexedItem, int, &IndexedItem::key, &IndexedItem::m_dictLink>;
+using ItemLru = List<IndexedItem, &IndexedItem::m_lruLink>;
+using ItemByExpiry = SortedList<IndexedItem, long long, &IndexedItem::expiry, &IndexedItem::m_expiryLink>;
+using ItemIndex = MultiIndex<IndexedItem, ItemDict, ItemLru, ItemByExpiry>;
+
+TEST(IntrusiveMultiIndexTest, InsertRemove) {
+    IndexedItem a(1, 30);
+    IndexedItem b(2, 10);
+    IndexedItem c(3, 20);
+
+    ItemIndex items;
+    EXPECT_TRUE(items.isEmpty());
+    EXPECT_TRUE(items.insert(&a));
+    EXPECT_TRUE(items.insert(&b));
+    EXPECT_TRUE(items.insert(&c));
+    EXPECT_FALSE(items.isEmpty());
+
+    EXPECT_EQ(&b, items.index<0>().get(2));
+    EXPECT_EQ(&c, items.index<1>().head());
+    EXPECT_EQ(&a, items.index<1>().tail());
+    EXPECT_EQ(&b, items.index<2>().head());
+    EXPECT_EQ(&a, items.index<2>().tail());
+
+    items.remove(&b);
+    EXPECT_FALSE(b.m_dictLink.isLinked());
+    EXPECT_FALSE(b.m_lruLink.isLinked());
+    EXPECT_FALSE(b.m_expiryLink.isLinked());
+    EXPECT_EQ(nullptr, items.index<0>().get(2));
+    EXPECT_EQ(&c, items.index<2>().head());
+
+    items.unlinkAll();
+    EXPECT_TRUE(items.isEmpty());
+    EXPECT_TRUE(items.index<1>().isEmpty());
+    EXPECT_TRUE(items.index<2>().isEmpty());
+}
+
+TEST(IntrusiveMultiIndexTest, DuplicateKeyIsRejected) {
+    IndexedItem a(1, 10);
+    IndexedItem duplicate(1, 20);
+
+    ItemIndex items;
+    EXPECT_TRUE(items.insert(&a));
+    EXPECT_FALSE(items.insert(&duplicate));
+
+    // A rejected node must not be left behind in any of the indices.
+    EXPECT_FALSE(duplicate.m_dictLink.isLinked());
+    EXPECT_FALSE(duplicate.m_lruLink.isLinked());
+    EXPECT_FALSE(duplicate.m_expiryLink.isLinked());
+    EXPECT_EQ(&a, items.index<1>().tail());
+}
+
+TEST(IntrusiveMultiIndexTest, Touch) {
+    IndexedItem a(1, 10);
+    IndexedItem b(2, 20);
+
+    ItemIndex items;
+    items.insert(&a);
+    items.insert(&b);
+    EXPECT_EQ(&b, items.index<1>().head());
+
+    a.expiry = 30;
+    items.touch(&a);
+    EXPECT_EQ(&a, items.index<1>().head());
+    EXPECT_EQ(&b, items.index<2>().head());
+    EXPECT_EQ(&a, items.index<2>().tail());
+    EXPECT_EQ(&a, items.index<0>().get(1));
+}
@@ -0,0 +1,149 @@
+#include "intrusive_containers.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+using namespace galib;
+
+class TimerItem {
+  public:
+    TimerItem(int id_, std::uint64_t expiresAt_)
+        : id(id_)
+        , expiresAt(expiresAt_) {}
+
+    int id;
+    std::uint64_t expiresAt;
+
+    Link<TimerItem> m_timerLink;
+};
+
+using ItemTimers = TimerWheel<TimerItem, &TimerItem::expiresAt, &TimerItem::m_timerLink>;
+
+TEST(IntrusiveTimerWheelTest, ExpireInOrder) {
+    ItemTimers timers(1000);
+    EXPECT_TRUE(timers.isEmpty());
+
+    // Expiration times spread over several wheels.
+    std::vector<std::uint64_t> times{1001, 1005, 1063, 1064, 1100, 5000, 1000 + 4096, 300000, 99999999};
+    std::vector<TimerItem *> items;
+    for (size_t i = 0; i < times.size(); i++) {
+        items.push_back(new TimerItem(static_cast<int>(i), times[i]));
+        timers.schedule(items.back());
+    }
+    EXPECT_FALSE(timers.isEmpty());
+
+    std::vector<std::uint64_t> expiredAt;
+    auto onExpired = [&](TimerItem *item) {
+        // An item must never expire before its time, nor later than the time we advanced to.
+        EXPECT_LE(item->expiresAt, timers.now());
+        expiredAt.push_back(item->expiresAt);
+        delete item;
+    };
+
+    EXPECT_EQ(0, timers.advance(1000, onExpired));
+    EXPECT_EQ(2, timers.advance(1010, onExpired));
+    EXPECT_EQ(3, timers.advance(4999, onExpired));
+    EXPECT_EQ(2, timers.advance(299999, onExpired));
+    EXPECT_EQ(1, timers.advance(300000, onExpired));
+    EXPECT_EQ(1, timers.advance(100000000, onExpired));
+    EXPECT_TRUE(timers.isEmpty());
+
+    std::vector<std::uint64_t> expected(times);
+    EXPECT_EQ(expected, expiredAt);
+}
+
+TEST(IntrusiveTimerWheelTest, CancelAndReschedule) {
+    ItemTimers timers;
+    TimerItem a(1, 10);
+    TimerItem b(2, 20);
+    TimerItem c(3, 30);
+    timers.schedule(&a);
+    timers.schedule(&b);
+    timers.schedule(&c);
+
+    timers.cancel(&a);
+    b.expiresAt = 100;
+    timers.schedule(&b);
+
+    std::vector<int> expired;
+    auto onExpired = [&](TimerItem *item) { expired.push_back(item->id); };
+    timers.advance(50, onExpired);
+    EXPECT_EQ(std::vector<int>({3}), expired);
+
+    // Deleted (self unlinked) items are simply gone.
+    TimerItem *d = new TimerItem(4, 60);
+    timers.schedule(d);
+    delete d;
+
+    // An item scheduled in the past expires on the next advance.
+    a.expiresAt = 1;
+    timers.schedule(&a);
+    timers.advance(51, onExpired);
+    timers.advance(200, onExpired);
+    EXPECT_EQ(std::vector<int>({3, 1, 2}), expired);
+    EXPECT_TRUE(timers.isEmpty());
+}
+
+TEST(IntrusiveTimerWheelTest, ManyRandom) {
+    ItemTimers timers(0);
+    std::vector<TimerItem *> items;
+    unsigned long long seed = 12345;
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        items.push_back(new TimerItem(i, 1 + (seed >> 33) % 1000000));
+        timers.schedule(items.back());
+    }
+
+    size_t expired = 0;
+    for (std::uint64_t now = 0; now <= 1000000; now += 777) {
+        expired += timers.advance(now, [&](TimerItem *item) {
+            EXPECT_LE(item->expiresAt, now);
+            EXPECT_GT(item->expiresAt + 777, now);
+        });
+    }
+    expired += timers.advance(1000001, [](TimerItem *) {});
+    EXPECT_EQ(items.size(), expired);
+
+    for (TimerItem *item : items) {
+        delete item;
+    }
+}
+
+TEST(IntrusiveTimerWheelTest, LongIdlePeriods) {
+    // Without the jumps over the empty turns of the first wheel, these advances would take billions of iterations.
+    ItemTimers timers(0);
+    EXPECT_EQ(0, timers.advance(std::uint64_t(1) << 50, [](TimerItem *) {}));
+    EXPECT_EQ(std::uint64_t(1) << 50, timers.now());
+
+    std::uint64_t start = timers.now();
+    std::vector<std::uint64_t> delays{1, 64, 4000, 4096, 1 << 20, std::uint64_t(1) << 30, std::uint64_t(1) << 35};
+    std::vector<TimerItem *> items;
+    for (size_t i = 0; i < delays.size(); i++) {
+        items.push_back(new TimerItem(static_cast<int>(i), start + delays[i]));
+        timers.schedule(items.back());
+    }
+
+    std::vector<int> expired;
+    auto onExpired = [&](TimerItem *item) {
+        // A node cascaded from an upper wheel on its expiration tick expires on the next one.
+        EXPECT_LE(item->expiresAt, timers.now());
+        EXPECT_GE(item->expiresAt + 1, timers.now());
+        expired.push_back(item->id);
+    };
+    for (std::uint64_t delay : delays) {
+        EXPECT_EQ(1, timers.advance(start + delay + 1, onExpired));
+    }
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5, 6}), expired);
+    EXPECT_TRUE(timers.isEmpty());
+
+    // One large advance expires them all, late.
+    for (TimerItem *item : items) {
+        item->expiresAt += std::uint64_t(1) << 36;
+        timers.schedule(item);
+    }
+    EXPECT_EQ(items.size(), timers.advance(timers.now() + (std::uint64_t(1) << 40), [](TimerItem *) {}));
+
+    for (TimerItem *item : items) {
+        delete item;
+    }
+}
@@ -0,0 +1,68 @@
+#include "lz_codec.h"
+#include "gtest/gtest.h"
+
+#include <random>
+#include <string>
+
+using namespace galib;
+
+static std::string roundTrip(const std::string &data, size_t *compressedSize = nullptr) {
+    std::string compressed;
+    lzCompress(data.data(), data.size(), compressed);
+    if (compressedSize != nullptr) {
+        *compressedSize = compressed.size();
+    }
+    std::string decompressed;
+    EXPECT_TRUE(lzDecompress(compressed.data(), compressed.size(), decompressed));
+    return decompressed;
+}
+
+TEST(LzCodecTest, RoundTrip) {
+    EXPECT_EQ("", roundTrip(""));
+    EXPECT_EQ("abc", roundTrip("abc"));
+    EXPECT_EQ("abcdabcdabcdabcdabcd", roundTrip("abcdabcdabcdabcdabcd"));
+
+    // Overlapping matches and long runs (extra lengths).
+    std::string runs = std::string(1000, 'x') + "y" + std::string(300, 'z');
+    size_t compressedSize = 0;
+    EXPECT_EQ(runs, roundTrip(runs, &compressedSize));
+    EXPECT_LT(compressedSize, 30u);
+
+    std::string text;
+    for (int i = 0; i < 2000; i++) {
+        text += "/home/user/project/src/file_" + std::to_string(i % 97) + ".cpp;";
+    }
+    EXPECT_EQ(text, roundTrip(text, &compressedSize));
+    EXPECT_LT(compressedSize * 4, text.size());
+
+    // Incompressible data, longer than the window.
+    std::mt19937 random(42);
+    std::string noise(200000, '\0');
+    for (char &c : noise) {
+        c = static_cast<char>(random());
+    }
+    EXPECT_EQ(noise, roundTrip(noise, &compressedSize));
+    EXPECT_LT(compressedSize, noise.size() + noise.size() / 200);
+}
+
+TEST(LzCodecTest, InvalidData) {
+    std::string data = "hello hello hello hello hello";
+    std::string compressed;
+    lzCompress(data.data(), data.size(), compressed);
+
+    std::string out;
+    EXPECT_FALSE(lzDecompress(compressed.data(), compressed.size() / 2, out));
+    out.clear();
+    EXPECT_FALSE(lzDecompress(compressed.data(), 0, out));
+
+    // A size that the data cannot expand to.
+    std::string huge = "\xff\xff\xff\xff\x0f";
+    huge.push_back('\0');
+    out.clear();
+    EXPECT_FALSE(lzDecompress(huge.data(), huge.size(), out));
+
+    // A match before the start of the data.
+    std::string backwards = "\x08\x00\x10\x00";
+    out.clear();
+    EXPECT_FALSE(lzDecompress(backwards.data(), backwards.size(), out));
+}
@@ -0,0 +1,135 @@
+#include "sharded_cache.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+using namespace galib;
+
+class SquareCache : public Cache<int, long long, 2> {
+  protected:
+    KeyValue *newCacheValue(const int &key, int) override {
+        KeyValue *kv = new KeyValue;
+        kv->data = static_cast<long long>(key) * key;
+        return kv;
+    }
+};
+
+TEST(ShardedCacheTest, GetRemove) {
+    ShardedCache<SquareCache, 4> cache;
+    EXPECT_EQ(0, cache.getTotalCount());
+
+    EXPECT_EQ(9, cache.get(3));
+    EXPECT_EQ(16, cache.get(4));
+    EXPECT_EQ(9, cache.find(3));
+    EXPECT_EQ(0, cache.find(5));
+    EXPECT_EQ(2, cache.getTotalCount());
+    EXPECT_EQ(2 * sizeof(SquareCache::KeyValue), cache.getTotalMemUsage());
+
+    cache.remove(3);
+    EXPECT_EQ(0, cache.find(3));
+    EXPECT_EQ(1, cache.getTotalCount());
+
+    EXPECT_EQ(16, cache.get(4));
+    CacheLevelStats stats = cache.getStats(0);
+    EXPECT_EQ(1, stats.hits);
+    EXPECT_EQ(2, stats.misses);
+    EXPECT_EQ(1, stats.count);
+
+    SquareCache::Handle handle = cache.getHandle(5);
+    EXPECT_EQ(25, *handle);
+    cache.remove(5);
+    EXPECT_EQ(25, *handle);
+    handle.reset();
+
+    long long *value = nullptr;
+    cache.apply(4, [&](SquareCache &shard) { value = shard.findPtr(4); });
+    EXPECT_NE(nullptr, value);
+}
+
+TEST(ShardedCacheTest, GlobalCapacity) {
+    ShardedCache<SquareCache, 4> cache;
+    cache.configureCapacity(100, static_cast<size_t>(-1));
+
+    // A hot shard uses the whole capacity, not a quarter of it.
+    std::vector<int> hotKeys;
+    for (int key = 0; hotKeys.size() < 150; key++) {
+        if (cache.shardIndex(key) == 0) {
+            hotKeys.push_back(key);
+        }
+    }
+    for (int key : hotKeys) {
+        cache.get(key);
+    }
+    EXPECT_EQ(100, cache.getTotalCount());
+    EXPECT_EQ(100, cache.apply(hotKeys[0], [](SquareCache &shard) { return shard.getTotalCount(); }));
+    // The least recently used values were evicted.
+    EXPECT_EQ(0, cache.find(hotKeys[49]));
+    EXPECT_EQ(hotKeys[50] * hotKeys[50], cache.find(hotKeys[50]));
+
+    for (int key = 0; key < 1000; key++) {
+        cache.get(key);
+        EXPECT_GE(100, cache.getTotalCount());
+    }
+
+    cache.configureCapacity(50, static_cast<size_t>(-1));
+    EXPECT_EQ(50, cache.getTotalCount());
+}
+
+TEST(ShardedCacheTest, ConcurrentGet) {
+    ShardedCache<SquareCache, 8> cache;
+    cache.configureLevel(0, 800, 1024 * 1024);
+
+    const int keys = 1000;
+    std::vector<std::thread> threads;
+    std::vector<int> errors(4, 0);
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, &errors, t]() {
+            for (int i = 0; i < 20000; i++) {
+                int key = (i * 31 + t * 7) % keys;
+                if (cache.get(key) != static_cast<long long>(key) * key) {
+                    errors[t]++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < 4; t++) {
+        EXPECT_EQ(0, errors[t]);
+    }
+    EXPECT_EQ(keys, cache.getTotalCount());
+}
+
+TEST(ShardedCacheTest, GetMany) {
+    ShardedCache<SquareCache, 4> cache;
+    cache.get(3);
+
+    std::vector<int> keys = {1, 2, 3, 4, 5, 6, 7, 8, 9, 3};
+    std::vector<long long> values(keys.size());
+    EXPECT_EQ(2, cache.getMany(keys.data(), keys.size(), values.data()));
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(static_cast<long long>(keys[i]) * keys[i], values[i]);
+    }
+    EXPECT_EQ(9, cache.getTotalCount());
+    EXPECT_EQ(0, cache.getMany(nullptr, 0, nullptr));
+}
+
+class PathCache : public Cache<std::string, int, 1> {};
+
+TEST(ShardedCacheTest, Invalidate) {
+    ShardedCache<PathCache, 4> cache;
+    cache.configurePrefixIndex('/');
+    for (int i = 0; i < 20; i++) {
+        cache.get("/dir" + std::to_string(i % 2) + "/" + std::to_string(i));
+    }
+    EXPECT_TRUE(cache.setTag("/dir0/0", "reload"));
+    EXPECT_TRUE(cache.setTag("/dir1/1", "reload"));
+
+    EXPECT_EQ(2, cache.invalidateTag("reload"));
+    EXPECT_EQ(18, cache.getTotalCount());
+    EXPECT_EQ(9, cache.invalidatePrefix("/dir0/"));
+    EXPECT_EQ(9, cache.getTotalCount());
+}
@@ -0,0 +1,154 @@
+#include "cache_snapshot.h"
+#include "static_cache.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+using namespace galib;
+
+// Counts the allocations of the whole program: these tests have their own executable (static_cache_tests), so that
+// the other tests keep the allocator of the library. All the forms are replaced, so that each delete matches its new.
+static std::atomic<size_t> allocationCount{0};
+
+static void *countedAlloc(size_t size, size_t alignment) {
+    allocationCount++;
+    size = (size != 0) ? size : 1;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void *countedNew(size_t size, size_t alignment) {
+    if (void *p = countedAlloc(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return countedNew(size, 0); }
+void *operator new[](size_t size) { return countedNew(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size, 0); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return countedAlloc(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return countedAlloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+
+class SlabSquareCache : public StaticCache<int, long, 2, 8> {
+  public:
+    int loads = 0;
+
+  protected:
+    bool loadValue(const int &key, long &value) override {
+        loads++;
+        value = static_cast<long>(key) * key;
+        return key >= 0;
+    }
+};
+
+TEST(StaticCacheTest, NoAllocationAfterConstruction) {
+    SlabSquareCache cache;
+    cache.configureLevel(0, 4, 99999);
+    cache.configureLevel(1, 16, 99999);
+    cache.configureNegativeCaching(2, 0);
+    EXPECT_EQ(8u, cache.getFreeCount());
+
+    size_t allocations = allocationCount;
+    for (int round = 0; round < 10; round++) {
+        for (int key = -2; key < 20; key++) {
+            EXPECT_EQ(key >= 0 ? static_cast<long>(key) * key : 0, cache.get(key));
+        }
+        cache.put(100, 7);
+        cache.remove(3);
+    }
+    EXPECT_EQ(allocations, allocationCount);
+
+    // The slab holds the values and the negative entries: level 1 never reaches its limit.
+    EXPECT_EQ(0u, cache.getFreeCount());
+    EXPECT_EQ(8u, cache.getTotalCount() + cache.getNegativeCount());
+    EXPECT_EQ(7, cache.find(100));
+}
+
+TEST(StaticCacheTest, PinnedSlab) {
+    SlabSquareCache cache;
+    std::vector<SlabSquareCache::Handle> handles;
+    for (int key = 0; key < 8; key++) {
+        handles.push_back(cache.getHandle(key));
+    }
+    EXPECT_EQ(0u, cache.getFreeCount());
+
+    // All the nodes are pinned: the next one comes from the heap.
+    EXPECT_EQ(81, cache.get(9));
+    EXPECT_EQ(9u, cache.getTotalCount());
+    handles.clear();
+
+    cache.clear();
+    EXPECT_EQ(8u, cache.getFreeCount());
+}
+
+TEST(StaticCacheTest, InvalidSnapshot) {
+    SlabSquareCache cache;
+    for (int key = 0; key < 8; key++) {
+        cache.get(key);
+    }
+    std::string bytes;
+    PodCacheSerializer serializer;
+    cache.serialize(bytes, serializer);
+
+    // Reading the snapshot does not take nodes from the full slab: nothing is evicted.
+    EXPECT_FALSE(cache.deserialize(bytes.data(), bytes.size() - 1, serializer));
+    EXPECT_EQ(8u, cache.getTotalCount());
+    EXPECT_EQ(0u, cache.getFreeCount());
+
+    EXPECT_TRUE(cache.deserialize(bytes.data(), bytes.size(), serializer));
+    EXPECT_EQ(8u, cache.getTotalCount());
+    EXPECT_EQ(49, cache.find(7));
+}
+
+TEST(StaticCacheTest, LargerSnapshot) {
+    Cache<int, long, 2> large;
+    large.configureLevel(0, 4, 99999);
+    for (int key = 0; key < 12; key++) {
+        large.put(key, static_cast<long>(key) * key);
+    }
+    std::string bytes;
+    PodCacheSerializer serializer;
+    large.serialize(bytes, serializer);
+
+    // Only the 8 most recent values fit in the slab, no node comes from the heap.
+    SlabSquareCache cache;
+    cache.configureLevel(0, 4, 99999);
+    EXPECT_TRUE(cache.deserialize(bytes.data(), bytes.size(), serializer));
+    EXPECT_EQ(8u, cache.getTotalCount());
+    EXPECT_EQ(0u, cache.getFreeCount());
+    EXPECT_EQ(4u, cache.getCount(0));
+    EXPECT_EQ(nullptr, cache.findPtr(3));
+    EXPECT_EQ(16, cache.find(4));
+    EXPECT_EQ(121, cache.find(11));
+    EXPECT_EQ(0, cache.loads);
+}
@@ -0,0 +1,37 @@
+#include "thread_pool.h"
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace galib;
+
+TEST(ThreadPoolTest, Async) {
+    ThreadPool pool(3);
+    EXPECT_EQ(3, pool.threadCount());
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; i++) {
+        results.push_back(pool.async([i]() { return i * i; }));
+    }
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(i * i, results[i].get());
+    }
+
+    std::future<int> failed = pool.async([]() -> int { throw std::runtime_error("failed"); });
+    EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, BoundedQueueRunsEverything) {
+    std::atomic<int> done(0);
+    {
+        // A single queued job: submit blocks until a thread takes the previous one.
+        ThreadPool pool(2, 1);
+        for (int i = 0; i < 1000; i++) {
+            EXPECT_TRUE(pool.submit([&done]() { done++; }));
+        }
+    }
+    // The destructor runs the queued jobs.
+    EXPECT_EQ(1000, done.load());
+}
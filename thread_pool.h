@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace galib {
+
+/// @brief Fixed number of threads running the submitted jobs in order, with a bounded queue.
+/// @example ThreadPool pool(4);
+/// std::future<int> answer = pool.async([]() { return 42; });
+class ThreadPool {
+  public:
+    /// @param maxQueued number of jobs waiting for a thread before submit blocks the caller.
+    explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency(), size_t maxQueued = 1024)
+        : _maxQueued(maxQueued > 0 ? maxQueued : 1) {
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        for (unsigned int i = 0; i < threadCount; i++) {
+            _threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief Runs the jobs already submitted, then joins the threads.
+    virtual ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _jobAvailable.notify_all();
+        _spaceAvailable.notify_all();
+        for (std::thread &thread : _threads) {
+            thread.join();
+        }
+    }
+
+    /// @brief Queues the job. Blocks while the queue is full.
+    /// @returns false if the pool is being destroyed (the job is not run).
+    bool submit(std::function<void()> job) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _spaceAvailable.wait(lock, [this]() { return _stopping || _jobs.size() < _maxQueued; });
+            if (_stopping) {
+                return false;
+            }
+            _jobs.push_back(std::move(job));
+        }
+        _jobAvailable.notify_one();
+        return true;
+    }
+
+    /// @brief Queues fn and returns the future of its result (or of its exception).
+    template <typename F> auto async(F fn) -> std::future<decltype(fn())> {
+        typedef decltype(fn()) R;
+        std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::move(fn));
+        std::future<R> result = task->get_future();
+        submit([task]() { (*task)(); });
+        return result;
+    }
+
+    size_t threadCount() const { return _threads.size(); }
+
+  private:
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _jobAvailable.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+                if (_jobs.empty()) {
+                    return;
+                }
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            _spaceAvailable.notify_one();
+            job();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _jobAvailable;
+    std::condition_variable _spaceAvailable;
+    std::deque<std::function<void()>> _jobs;
+    size_t _maxQueued;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+};
+
+} // namespace galib
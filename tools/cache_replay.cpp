@@ -0,0 +1,142 @@
+// Replays a cache trace (see cache_trace.h) on a simulated cache and prints its hit ratio, memory use and throughput.
+// Usage: cache_replay <trace> [--policy lru|slru|2q|arc|clock] [--level maxCount,maxMemUsage]... [--capacity
+//        maxCount,maxMemUsage] [--admission expectedCount]
+// Each --level adds a level (1 to 4, default: a single unlimited level).
+#include "cache_trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace galib;
+
+namespace {
+
+struct Limits {
+    unsigned long long maxCount;
+    unsigned long long maxMemUsage;
+};
+
+struct Options {
+    std::string tracePath;
+    std::string policy = "lru";
+    std::vector<Limits> levels;
+    bool hasCapacity = false;
+    Limits capacity = {0, 0};
+    size_t admission = 0;
+};
+
+const unsigned int maxLevelCount = 4;
+
+bool parseLimits(const char *text, Limits &limits) {
+    return std::sscanf(text, "%llu,%llu", &limits.maxCount, &limits.maxMemUsage) == 2;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (arg[0] != '-') {
+            options.tracePath = arg;
+            continue;
+        }
+        if (value == nullptr) {
+            return false;
+        }
+        i++;
+        Limits limits;
+        if (std::strcmp(arg, "--policy") == 0) {
+            options.policy = value;
+        } else if (std::strcmp(arg, "--level") == 0 && parseLimits(value, limits)) {
+            options.levels.push_back(limits);
+        } else if (std::strcmp(arg, "--capacity") == 0 && parseLimits(value, options.capacity)) {
+            options.hasCapacity = true;
+        } else if (std::strcmp(arg, "--admission") == 0) {
+            options.admission = static_cast<size_t>(std::strtoull(value, nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return !options.tracePath.empty() && options.levels.size() <= maxLevelCount;
+}
+
+template <unsigned int TMaxLevel, typename TPolicy> void replay(const CacheTrace &trace, const Options &options) {
+    ReplayCache<TMaxLevel, TPolicy> cache;
+    for (size_t i = 0; i < options.levels.size(); i++) {
+        cache.configureLevel(static_cast<int>(i), static_cast<unsigned int>(options.levels[i].maxCount),
+                             static_cast<size_t>(options.levels[i].maxMemUsage));
+    }
+    if (options.hasCapacity) {
+        cache.configureCapacity(static_cast<size_t>(options.capacity.maxCount),
+                                static_cast<size_t>(options.capacity.maxMemUsage));
+    }
+    cache.configureAdmission(options.admission);
+
+    CacheReplayResult result = replayTrace(trace, cache);
+    std::printf("operations    %llu in %.3f s (%.2f M/s)\n", static_cast<unsigned long long>(result.operations),
+                result.seconds, result.operationsPerSecond() / 1e6);
+    std::printf("hit ratio     %.2f %%\n", result.hitRatio() * 100);
+    std::printf("peak memory   %llu\n", static_cast<unsigned long long>(result.peakMemUsage));
+    std::printf("level        hits      misses   evictions       count      memory\n");
+    for (size_t i = 0; i < result.levels.size(); i++) {
+        const CacheLevelStats &stats = result.levels[i];
+        std::printf("%5u %11llu %11llu %11llu %11llu %11llu\n", static_cast<unsigned int>(i),
+                    static_cast<unsigned long long>(stats.hits), static_cast<unsigned long long>(stats.misses),
+                    static_cast<unsigned long long>(stats.evictions), static_cast<unsigned long long>(stats.count),
+                    static_cast<unsigned long long>(stats.memUsage));
+    }
+}
+
+template <typename TPolicy> void replayLevels(const CacheTrace &trace, const Options &options) {
+    switch (options.levels.size()) {
+    case 0:
+    case 1:
+        replay<1, TPolicy>(trace, options);
+        break;
+    case 2:
+        replay<2, TPolicy>(trace, options);
+        break;
+    case 3:
+        replay<3, TPolicy>(trace, options);
+        break;
+    default:
+        replay<maxLevelCount, TPolicy>(trace, options);
+        break;
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s <trace> [--policy lru|slru|2q|arc|clock] [--level maxCount,maxMemUsage]... "
+                             "[--capacity maxCount,maxMemUsage] [--admission expectedCount]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    CacheTrace trace;
+    if (!trace.load(options.tracePath)) {
+        std::fprintf(stderr, "cannot read the trace %s\n", options.tracePath.c_str());
+        return 1;
+    }
+
+    if (options.policy == "lru") {
+        replayLevels<LruPolicy>(trace, options);
+    } else if (options.policy == "slru") {
+        replayLevels<SlruPolicy<>>(trace, options);
+    } else if (options.policy == "2q") {
+        replayLevels<TwoQPolicy<>>(trace, options);
+    } else if (options.policy == "arc") {
+        replayLevels<ArcPolicy>(trace, options);
+    } else if (options.policy == "clock") {
+        replayLevels<ClockPolicy>(trace, options);
+    } else {
+        std::fprintf(stderr, "unknown policy %s\n", options.policy.c_str());
+        return 2;
+    }
+    return 0;
+}